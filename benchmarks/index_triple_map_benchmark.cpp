@@ -0,0 +1,149 @@
+#include "index_triple_map.h"
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tinyobjloader/tiny_obj_loader.h>
+
+
+// Compares the IndexTripleMap with the std::unordered_map the OBJ loader used before, on the
+// corners of the teapot and of a synthetic grid mesh with about 10M corners, in file order and
+// with shuffled triangles. Run from the repository root or pass the path of an OBJ file.
+
+
+namespace
+{
+    const int GRID_SIZE = 1291; ///< quads per side, 6 * 1291^2 is about 10M corners
+    const int REPETITIONS = 3;  ///< the fastest run counts
+
+    /// The hash the loader used before, summing the hashes of the three indices.
+    struct VertexHasher
+    {
+        std::size_t operator()(const std::array<int, 3>& vtx) const
+        {
+            return std::hash<int>()(vtx[0]) + std::hash<int>()(vtx[1]) + std::hash<int>()(vtx[2]);
+        }
+    };
+
+    double fastestRun(const std::function<void()>& function)
+    {
+        double fastest = 0.0;
+        for (int i = 0; i < REPETITIONS; ++i)
+        {
+            const auto begin = std::chrono::steady_clock::now();
+            function();
+            const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - begin;
+            fastest = (0 == i) ? time.count() : std::min(fastest, time.count());
+        }
+        return fastest;
+    }
+
+    void run(const char* name, const std::vector<std::array<int, 3>>& corners)
+    {
+        size_t unordered_map_size = 0;
+        const double unordered_map_time = fastestRun([&] {
+            std::unordered_map<std::array<int, 3>, int, VertexHasher> unique_indices;
+            unique_indices.reserve(corners.size());
+            for (const std::array<int, 3>& corner: corners)
+                unique_indices.emplace(corner, static_cast<int>(unique_indices.size()));
+            unordered_map_size = unique_indices.size();
+        });
+
+        size_t flat_map_size = 0;
+        const double flat_map_time = fastestRun([&] {
+            IndexTripleMap unique_indices(corners.size() / 4); // sized like the loader does
+            for (const std::array<int, 3>& corner: corners)
+                unique_indices.emplace(corner, static_cast<uint32_t>(unique_indices.size()));
+            flat_map_size = unique_indices.size();
+        });
+
+        std::printf("%-24s %9zu corners %9zu unique   unordered_map %8.1f ms   IndexTripleMap %8.1f ms%s\n", name,
+                    corners.size(), flat_map_size, unordered_map_time, flat_map_time,
+                    unordered_map_size == flat_map_size ? "" : "   MISMATCH");
+    }
+
+    bool loadCorners(const std::string& filename, std::vector<std::array<int, 3>>& corners)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        const std::string data = stream.str();
+
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string error;
+        if (!ObjParser::parse(data.data(), data.size(), "", &attrib, &shapes, &materials, nullptr, &error))
+            return false;
+
+        for (const tinyobj::shape_t& shape: shapes)
+        {
+            for (const tinyobj::index_t& index: shape.mesh.indices)
+                corners.push_back({index.vertex_index, index.texcoord_index, index.normal_index});
+        }
+        return true;
+    }
+
+    /// Two triangles per quad, each vertex shared by up to six of them like in a smooth mesh.
+    std::vector<std::array<int, 3>> gridCorners()
+    {
+        std::vector<std::array<int, 3>> corners;
+        corners.reserve(6 * size_t{GRID_SIZE} * GRID_SIZE);
+        for (int y = 0; y < GRID_SIZE; ++y)
+        {
+            for (int x = 0; x < GRID_SIZE; ++x)
+            {
+                const int v = y * (GRID_SIZE + 1) + x;
+                const int quad[] = {v, v + 1, v + GRID_SIZE + 2, v + GRID_SIZE + 1};
+                for (int corner: {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]})
+                    corners.push_back({corner, corner, corner});
+            }
+        }
+        return corners;
+    }
+
+    std::vector<std::array<int, 3>> shuffleTriangles(const std::vector<std::array<int, 3>>& corners)
+    {
+        std::vector<size_t> order(corners.size() / 3);
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+        std::vector<std::array<int, 3>> shuffled;
+        shuffled.reserve(corners.size());
+        for (size_t triangle: order)
+            shuffled.insert(shuffled.end(), corners.begin() + 3 * triangle, corners.begin() + 3 * triangle + 3);
+        return shuffled;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    const std::string obj_file = argc > 1 ? argv[1] : "assets/models/teapot/teapot.obj";
+
+    std::vector<std::array<int, 3>> corners;
+    if (loadCorners(obj_file, corners))
+        run(obj_file.substr(obj_file.find_last_of("/\\") + 1).c_str(), corners);
+    else
+        std::printf("Cannot load %s, skipping it\n", obj_file.c_str());
+
+    const std::vector<std::array<int, 3>> grid = gridCorners();
+    run("grid, file order", grid);
+    run("grid, shuffled", shuffleTriangles(grid));
+
+    return 0;
+}
@@ -1,41 +1,271 @@
 #include "asset_loader.h"
 
+#include "index_triple_map.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "obj_parser.h"
 #include "util.h"
 
 #include <QDebug>
+#include <QFile>
 #include <QFileInfo>
 #include <QString>
 
-#include <functional>
-#include <unordered_map>
-
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tinyobjloader/tiny_obj_loader.h>
 
+#include <algorithm>
+
 
 namespace
 {
-    struct VertexHasher
+    /// Files above this size are imported with ObjParser::stream which trades the parallel
+    /// front end for a peak memory close to the size of the resulting meshes.
+    const qint64 STREAMING_THRESHOLD = qint64{512} << 20;
+
+    /// Optimizes all meshes of a model, returns false if cancelled.
+    bool optimizeMeshes(std::vector<std::unique_ptr<Mesh>>& meshes, const std::atomic<bool>* cancel)
+    {
+        MeshOptimizer::VertexCacheStatistics before;
+        MeshOptimizer::VertexCacheStatistics after;
+        size_t lod_count = 1;
+        for (auto& mesh: meshes)
+        {
+            if (cancel && *cancel)
+                return false;
+            mesh->optimize(&before, &after);
+            mesh->generateLods();
+            lod_count = std::max(lod_count, mesh->getLodCount());
+        }
+
+        // meshes without a level draw their coarsest one instead
+        std::vector<size_t> lod_faces(lod_count, 0);
+        for (const auto& mesh: meshes)
+        {
+            for (size_t l = 0; l < lod_count; ++l)
+            {
+                const size_t level = std::min(l, mesh->getLodCount() - 1);
+                lod_faces[l] += 0 == level ? mesh->getFaceCount() : mesh->getLods()[level - 1].faces.size();
+            }
+        }
+
+        qDebug() << "Vertex cache ACMR" << before.acmr() << "->" << after.acmr() << ", ATVR" << before.atvr()
+                 << "->" << after.atvr();
+        qDebug() << "Triangles per level of detail:" << lod_faces;
+        return true;
+    }
+
+    template <typename T>
+    size_t capacityBytes(const std::vector<T>& data)
     {
-         std::size_t operator()(const std::array<int, 3>& vtx) const
-         {
-             return std::hash<int>()(vtx[0]) + std::hash<int>()(vtx[1]) + std::hash<int>()(vtx[2]);
-         }
+        return data.capacity() * sizeof(T);
+    }
+
+    /// Builds meshes directly from the triangles of ObjParser::stream.
+    ///
+    /// Only the current shape keeps transient state (its faces, the unique index triples and the
+    /// dedup map), every output array is allocated once with its final size.
+    class StreamingMeshBuilder : public ObjParser::Sink
+    {
+    public:
+        StreamingMeshBuilder(const std::string& obj_path, const tinyobj::attrib_t& attrib,
+                             const std::vector<tinyobj::material_t>& materials, const std::atomic<bool>* cancel)
+            : m_obj_path(obj_path)
+            , m_attrib(attrib)
+            , m_materials(materials)
+            , m_cancel(cancel)
+        {
+        }
+
+        void beginShape(size_t triangle_count) override
+        {
+            m_faces.clear();
+            m_faces.shrink_to_fit();
+            m_faces.reserve(triangle_count);
+            m_keys.clear();
+            // closed triangle meshes share each vertex between ~6 corners, uv seams add some more
+            m_unique_indices.reset(new IndexTripleMap(3 * triangle_count / 4));
+            m_material_id = -1;
+        }
+
+        void addTriangle(const tinyobj::index_t* corners, int material_id) override
+        {
+            if (m_faces.empty())
+                m_material_id = material_id; // assuming all faces in mesh have the same material
+
+            std::array<uint32_t, 3> face;
+            for (int v = 0; v < 3; ++v)
+            {
+                const std::array<int, 3> vtx_key = {corners[v].vertex_index, corners[v].texcoord_index,
+                                                    corners[v].normal_index};
+                const auto gl_index = static_cast<uint32_t>(m_keys.size());
+                const auto result = m_unique_indices->emplace(vtx_key, gl_index);
+                if (result.second)
+                    m_keys.push_back(vtx_key);
+                face[v] = result.first;
+            }
+            m_faces.push_back(face);
+        }
+
+        void endShape(bool keep) override
+        {
+            if (keep)
+                finishMesh();
+            m_unique_indices.reset();
+            m_keys.clear();
+            m_keys.shrink_to_fit();
+            m_faces.clear();
+            m_faces.shrink_to_fit();
+        }
+
+        bool cancelled() const override { return m_cancel && *m_cancel; }
+
+        std::vector<std::unique_ptr<Mesh>>& meshes() { return m_meshes; }
+        size_t peakMemory() const { return m_peak_memory; }
+        size_t outputMemory() const { return m_output_memory; }
+        bool valid() const { return m_valid; }
+
+    private:
+        void finishMesh()
+        {
+            auto mesh = std::make_unique<Mesh>();
+            if (!m_faces.empty() && -1 != m_material_id)
+            {
+                const tinyobj::material_t& material = m_materials[m_material_id];
+                if (!material.diffuse_texname.empty())
+                    mesh->setMaterial(m_obj_path + '/' + material.diffuse_texname);
+                // "d", or 1 - "Tr" if the MTL file only has that
+                mesh->setTranslucent(material.dissolve < 1.0f);
+            }
+
+            const auto vertex_count = static_cast<int>(m_attrib.vertices.size() / 3);
+            const auto normal_count = static_cast<int>(m_attrib.normals.size() / 3);
+            const auto texcoord_count = static_cast<int>(m_attrib.texcoords.size() / 2);
+            const bool has_normals = std::any_of(m_keys.begin(), m_keys.end(),
+                                                 [](const std::array<int, 3>& key) { return -1 != key[2]; });
+            const bool has_texcoords = std::any_of(m_keys.begin(), m_keys.end(),
+                                                   [](const std::array<int, 3>& key) { return -1 != key[1]; });
+
+            std::vector<Vec3D> positions;
+            std::vector<Vec3D> normals;
+            std::vector<std::pair<float, float>> texcoords;
+            positions.reserve(m_keys.size());
+            if (has_normals)
+                normals.reserve(m_keys.size());
+            if (has_texcoords)
+                texcoords.reserve(m_keys.size());
+
+            for (const std::array<int, 3>& key: m_keys)
+            {
+                // -1 marks a missing texcoord or normal, relative indices before the start resolve to other negatives
+                if (key[0] < 0 || key[0] >= vertex_count || key[1] < -1 || key[1] >= texcoord_count || key[2] < -1
+                    || key[2] >= normal_count)
+                {
+                    m_valid = false;
+                    return;
+                }
+
+                const float* v = &m_attrib.vertices[3 * key[0]];
+                positions.push_back(Vec3D{v[0], v[1], v[2]});
+                if (-1 != key[2])
+                {
+                    const float* n = &m_attrib.normals[3 * key[2]];
+                    normals.push_back(Vec3D{n[0], n[1], n[2]});
+                }
+                if (-1 != key[1])
+                {
+                    const float* t = &m_attrib.texcoords[2 * key[1]];
+                    texcoords.emplace_back(t[0], t[1]);
+                }
+            }
+
+            // everything of this shape is alive right now, which is the high-water mark of the import
+            const size_t output_bytes = capacityBytes(positions) + capacityBytes(normals) + capacityBytes(texcoords)
+                                        + capacityBytes(m_faces);
+            const size_t transient_bytes = capacityBytes(m_keys) + m_unique_indices->memoryUsage();
+            const size_t attrib_bytes = capacityBytes(m_attrib.vertices) + capacityBytes(m_attrib.normals)
+                                        + capacityBytes(m_attrib.texcoords);
+            m_peak_memory = std::max(m_peak_memory, attrib_bytes + m_output_memory + output_bytes + transient_bytes);
+            m_output_memory += output_bytes;
+
+            mesh->setPositions(std::move(positions));
+            mesh->setNormals(std::move(normals));
+            mesh->setTexCoords(std::move(texcoords));
+            mesh->setIndices(std::move(m_faces));
+            m_meshes.push_back(std::move(mesh));
+        }
+
+    private:
+        const std::string& m_obj_path;
+        const tinyobj::attrib_t& m_attrib;
+        const std::vector<tinyobj::material_t>& m_materials;
+        const std::atomic<bool>* m_cancel;
+
+        std::vector<std::array<uint32_t, 3>> m_faces;
+        std::vector<std::array<int, 3>> m_keys; ///< unique index triples in order of first use
+        std::unique_ptr<IndexTripleMap> m_unique_indices;
+        int m_material_id{-1};
+
+        std::vector<std::unique_ptr<Mesh>> m_meshes;
+        size_t m_output_memory{0};
+        size_t m_peak_memory{0};
+        bool m_valid{true};
     };
 }
 
 
-std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
+std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename, const std::atomic<bool>* cancel)
 {
+    std::vector<std::unique_ptr<Mesh>> cached_meshes = MeshCache::load(filename);
+    if (!cached_meshes.empty())
+        return cached_meshes;
+
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
+    std::vector<std::string> material_files;
 
     const std::string obj_path = QFileInfo(filename).absolutePath().toUtf8().constData();
 
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Cannot open file" << filename;
+        return {};
+    }
+    uchar* data = file.map(0, file.size());
+    if (!data)
+        return {};
+
     std::string err;
-    const bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.toUtf8().constData(), obj_path.c_str());
+    if (file.size() > STREAMING_THRESHOLD)
+    {
+        StreamingMeshBuilder builder(obj_path, attrib, materials, cancel);
+        const bool ret = ObjParser::stream(reinterpret_cast<const char*>(data), static_cast<size_t>(file.size()),
+                                           obj_path, &attrib, &materials, &material_files, &err, &builder);
+        file.unmap(data);
+        qDebug() << err.c_str();
+        if (!ret)
+            return {};
+        if (!builder.valid())
+        {
+            qDebug() << "Invalid vertex index in" << filename;
+            return {};
+        }
+
+        qDebug() << "Streamed import peak memory" << builder.peakMemory() / (1 << 20) << "MiB for"
+                 << builder.outputMemory() / (1 << 20) << "MiB of meshes";
+
+        if (!optimizeMeshes(builder.meshes(), cancel))
+            return {};
+        if (!MeshCache::store(filename, material_files, builder.meshes()))
+            qDebug() << "Could not write mesh cache for" << filename;
+        return std::move(builder.meshes());
+    }
+
+    const bool ret = ObjParser::parse(reinterpret_cast<const char*>(data), static_cast<size_t>(file.size()), obj_path,
+                                      &attrib, &shapes, &materials, &material_files, &err);
+    file.unmap(data);
     qDebug() << err.c_str();
     if (!ret)
         return {};
@@ -45,6 +275,9 @@ std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
 
     for (size_t s = 0; s < shapes.size(); s++)
     {
+        if (cancel && *cancel)
+            return {};
+
         std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>();
 
         const size_t face_count = shapes[s].mesh.num_face_vertices.size();
@@ -53,9 +286,11 @@ std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
             const int mat_id = shapes[s].mesh.material_ids[0]; // assuming all faces in mesh have the same material
             if (-1 != mat_id && !materials[mat_id].diffuse_texname.empty())
                 mesh->setMaterial(obj_path + '/' + materials[mat_id].diffuse_texname);
+            if (-1 != mat_id)
+                mesh->setTranslucent(materials[mat_id].dissolve < 1.0f);
         }
-        std::unordered_map<std::array<int, 3>, int, VertexHasher> unique_indices;
-        unique_indices.reserve(shapes[s].mesh.indices.size());
+        // closed triangle meshes share each vertex between ~6 corners, uv seams add some more
+        IndexTripleMap unique_indices(shapes[s].mesh.indices.size() / 4);
 
         // Loop over faces(polygon)
         size_t index_offset = 0;
@@ -70,7 +305,7 @@ std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
                 // access to vertex
                 tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
-                const int gl_index = unique_indices.size();
+                const auto gl_index = static_cast<uint32_t>(unique_indices.size());
                 const std::array<int, 3> vtx_key = {idx.vertex_index, idx.texcoord_index, idx.normal_index};
 
                 const auto result = unique_indices.emplace(vtx_key, gl_index);
@@ -100,7 +335,7 @@ std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
                 else
                 {
                     // use cached index
-                    face[v] = result.first->second;
+                    face[v] = result.first;
                 }
             }
             index_offset += fv;
@@ -112,5 +347,10 @@ std::vector<std::unique_ptr<Mesh>> AssetLoader::loadObj(const QString& filename)
         meshes.push_back(std::move(mesh));
     }
 
+    if (!optimizeMeshes(meshes, cancel))
+        return {};
+    if (!MeshCache::store(filename, material_files, meshes))
+        qDebug() << "Could not write mesh cache for" << filename;
+
     return meshes;
 }
@@ -1,10 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 class AssetLoader
 {
 public:
-    static std::vector<std::unique_ptr<class Mesh>> loadObj(const class QString& filename);
+    static std::vector<std::unique_ptr<class Mesh>> loadObj(const class QString& filename, const std::atomic<bool>* cancel = nullptr);
 };
@@ -0,0 +1,161 @@
+#include "bounds.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+
+namespace
+{
+    /// Vertices reduced side by side, four xyz triples fill three SSE or AVX registers per bound.
+    const size_t REDUCTION_WIDTH = 4;
+
+    // positions are reduced as one flat float array
+    static_assert(sizeof(Vec3D) == 3 * sizeof(float), "Vec3D must be three packed floats");
+
+    float maxScale(const QMatrix4x4& matrix)
+    {
+        return std::max({matrix.column(0).toVector3D().length(), matrix.column(1).toVector3D().length(),
+                         matrix.column(2).toVector3D().length()});
+    }
+}
+
+
+bool BoundingBox::contains(const QVector3D& point) const
+{
+    return min.x() <= point.x() && point.x() <= max.x() && min.y() <= point.y() && point.y() <= max.y()
+           && min.z() <= point.z() && point.z() <= max.z();
+}
+
+bool BoundingBox::intersects(const BoundingBox& other) const
+{
+    return min.x() <= other.max.x() && other.min.x() <= max.x() && min.y() <= other.max.y()
+           && other.min.y() <= max.y() && min.z() <= other.max.z() && other.min.z() <= max.z();
+}
+
+void BoundingBox::extend(const BoundingBox& other)
+{
+    min = QVector3D(std::min(min.x(), other.min.x()), std::min(min.y(), other.min.y()),
+                    std::min(min.z(), other.min.z()));
+    max = QVector3D(std::max(max.x(), other.max.x()), std::max(max.y(), other.max.y()),
+                    std::max(max.z(), other.max.z()));
+}
+
+BoundingBox BoundingBox::transformed(const QMatrix4x4& matrix) const
+{
+    if (isEmpty())
+        return {};
+
+    // Arvo: the new half extent along each axis is the absolute rotated half extent
+    const QVector3D center_out = matrix.map(center());
+    const QVector3D half = extent() / 2.0f;
+    float half_out[3];
+    for (int row = 0; row < 3; ++row)
+    {
+        half_out[row] = std::abs(matrix(row, 0)) * half.x() + std::abs(matrix(row, 1)) * half.y()
+                        + std::abs(matrix(row, 2)) * half.z();
+    }
+    const QVector3D half_extent(half_out[0], half_out[1], half_out[2]);
+    return {center_out - half_extent, center_out + half_extent};
+}
+
+BoundingBox BoundingBox::fromPositions(const std::vector<Vec3D>& positions)
+{
+    const size_t count = 3 * positions.size();
+    if (0 == count)
+        return {};
+    const float* coords = &positions[0].x;
+
+    // independent lanes instead of one running xyz, so the compiler can use packed min/max
+    const size_t lanes = 3 * REDUCTION_WIDTH;
+    float lane_min[lanes];
+    float lane_max[lanes];
+    for (size_t j = 0; j < lanes; ++j)
+    {
+        lane_min[j] = coords[j % 3];
+        lane_max[j] = coords[j % 3];
+    }
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes)
+    {
+        for (size_t j = 0; j < lanes; ++j)
+        {
+            lane_min[j] = coords[i + j] < lane_min[j] ? coords[i + j] : lane_min[j];
+            lane_max[j] = coords[i + j] > lane_max[j] ? coords[i + j] : lane_max[j];
+        }
+    }
+    // lanes start at a multiple of three, so lane j keeps reducing component j % 3
+    for (size_t j = 0; i < count; ++i, ++j)
+    {
+        lane_min[j] = std::min(lane_min[j], coords[i]);
+        lane_max[j] = std::max(lane_max[j], coords[i]);
+    }
+
+    float box_min[3] = {lane_min[0], lane_min[1], lane_min[2]};
+    float box_max[3] = {lane_max[0], lane_max[1], lane_max[2]};
+    for (size_t j = 3; j < lanes; ++j)
+    {
+        box_min[j % 3] = std::min(box_min[j % 3], lane_min[j]);
+        box_max[j % 3] = std::max(box_max[j % 3], lane_max[j]);
+    }
+    return {QVector3D(box_min[0], box_min[1], box_min[2]), QVector3D(box_max[0], box_max[1], box_max[2])};
+}
+
+
+bool BoundingSphere::contains(const QVector3D& point) const
+{
+    return (point - center).lengthSquared() <= radius * radius;
+}
+
+bool BoundingSphere::intersects(const BoundingSphere& other) const
+{
+    if (isEmpty() || other.isEmpty())
+        return false;
+    const float distance = radius + other.radius;
+    return (other.center - center).lengthSquared() <= distance * distance;
+}
+
+BoundingSphere BoundingSphere::transformed(const QMatrix4x4& matrix) const
+{
+    if (isEmpty())
+        return {};
+    return {matrix.map(center), radius * maxScale(matrix)};
+}
+
+BoundingSphere BoundingSphere::fromPositions(const std::vector<Vec3D>& positions, const BoundingBox& box)
+{
+    if (positions.empty())
+        return {};
+
+    // the box center is at most sqrt(3) times worse than the optimal sphere and needs a single pass
+    const float center[3] = {box.center().x(), box.center().y(), box.center().z()};
+    float lane_distance[REDUCTION_WIDTH] = {};
+
+    size_t i = 0;
+    for (; i + REDUCTION_WIDTH <= positions.size(); i += REDUCTION_WIDTH)
+    {
+        for (size_t j = 0; j < REDUCTION_WIDTH; ++j)
+        {
+            const Vec3D& p = positions[i + j];
+            const float dx = p.x - center[0];
+            const float dy = p.y - center[1];
+            const float dz = p.z - center[2];
+            const float distance = dx * dx + dy * dy + dz * dz;
+            lane_distance[j] = distance > lane_distance[j] ? distance : lane_distance[j];
+        }
+    }
+    for (size_t j = 0; i < positions.size(); ++i, ++j)
+    {
+        const Vec3D& p = positions[i];
+        const float dx = p.x - center[0];
+        const float dy = p.y - center[1];
+        const float dz = p.z - center[2];
+        lane_distance[j] = std::max(lane_distance[j], dx * dx + dy * dy + dz * dz);
+    }
+
+    const float squared_radius = *std::max_element(std::begin(lane_distance), std::end(lane_distance));
+    return {QVector3D(center[0], center[1], center[2]), std::sqrt(squared_radius)};
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include <limits>
+#include <vector>
+
+struct Vec3D;
+
+
+/// Axis aligned bounding box, a default constructed box is empty.
+struct BoundingBox
+{
+    QVector3D min{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                  std::numeric_limits<float>::max()};
+    QVector3D max{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                  std::numeric_limits<float>::lowest()};
+
+    bool isEmpty() const { return min.x() > max.x(); }
+    QVector3D center() const { return (min + max) / 2.0f; }
+    QVector3D extent() const { return max - min; }
+
+    bool contains(const QVector3D& point) const;
+    bool intersects(const BoundingBox& other) const;
+    void extend(const BoundingBox& other);
+    /// Smallest axis aligned box around the transformed box.
+    BoundingBox transformed(const QMatrix4x4& matrix) const;
+
+    static BoundingBox fromPositions(const std::vector<Vec3D>& positions);
+};
+
+
+/// Bounding sphere, empty while the radius is negative.
+struct BoundingSphere
+{
+    QVector3D center;
+    float radius{-1.0f};
+
+    bool isEmpty() const { return radius < 0.0f; }
+
+    bool contains(const QVector3D& point) const;
+    bool intersects(const BoundingSphere& other) const;
+    /// Exact for rotations, translations and uniform scales, otherwise scaled by the largest axis.
+    BoundingSphere transformed(const QMatrix4x4& matrix) const;
+
+    /// Centered on box, which has to be the bounding box of positions.
+    static BoundingSphere fromPositions(const std::vector<Vec3D>& positions, const BoundingBox& box);
+};
@@ -20,6 +20,18 @@ const QMatrix4x4& Camera::get_view() const
     return m_view_matrix;
 }
 
+std::array<QVector4D, 6> Camera::getFrustumPlanes(const QMatrix4x4& projection) const
+{
+    // Gribb and Hartmann: clip space bounds -w <= x, y, z <= w expressed with the rows of the matrix
+    const QMatrix4x4 pv = projection * m_view_matrix;
+    const QVector4D w = pv.row(3);
+    std::array<QVector4D, 6> planes = {{w + pv.row(0), w - pv.row(0), w + pv.row(1), w - pv.row(1), w + pv.row(2),
+                                        w - pv.row(2)}};
+    for (QVector4D& plane: planes)
+        plane /= plane.toVector3D().length();
+    return planes;
+}
+
 Vec3D Camera::getPosition() const
 {
     return Vec3D{m_pos.x(), m_pos.y(), m_pos.z()};
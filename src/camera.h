@@ -1,6 +1,9 @@
 #pragma once
 
 #include <QMatrix4x4>
+#include <QVector4D>
+
+#include <array>
 
 
 class Camera
@@ -11,6 +14,9 @@ public:
     void change_pitch(float angle);
     void change_yaw(float angle);
 
+    /// Left, right, bottom, top, near and far plane as (normal, distance) with normalized normals
+    /// pointing inside, so a point p is in front of a plane if dot(normal, p) + distance >= 0.
+    std::array<QVector4D, 6> getFrustumPlanes(const QMatrix4x4& projection) const;
     struct Vec3D getPosition() const;
     const QMatrix4x4& get_view() const;
     struct Vec3D getViewDirection() const;
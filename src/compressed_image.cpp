@@ -0,0 +1,261 @@
+#include "compressed_image.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+    // S3TC is an extension, the core headers don't define its enums
+    const GLenum COMPRESSED_RGB_S3TC_DXT1 = 0x83F0;
+    const GLenum COMPRESSED_RGBA_S3TC_DXT1 = 0x83F1;
+    const GLenum COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+
+    const uchar DDS_MAGIC[4] = {'D', 'D', 'S', ' '};
+    const uchar KTX2_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    const uint32_t DDPF_FOURCC = 0x4;
+    const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+
+    struct DdsHeader
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitch_or_linear_size;
+        uint32_t depth;
+        uint32_t mip_map_count;
+        uint32_t reserved1[11];
+        uint32_t pf_size;
+        uint32_t pf_flags;
+        uint32_t pf_four_cc;
+        uint32_t pf_rgb_bit_count;
+        uint32_t pf_masks[4];
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+
+    struct DdsHeaderDx10
+    {
+        uint32_t dxgi_format;
+        uint32_t resource_dimension;
+        uint32_t misc_flag;
+        uint32_t array_size;
+        uint32_t misc_flags2;
+    };
+
+    struct Ktx2Header
+    {
+        uint32_t vk_format;
+        uint32_t type_size;
+        uint32_t pixel_width;
+        uint32_t pixel_height;
+        uint32_t pixel_depth;
+        uint32_t layer_count;
+        uint32_t face_count;
+        uint32_t level_count;
+        uint32_t supercompression_scheme;
+        uint32_t dfd_byte_offset;
+        uint32_t dfd_byte_length;
+        uint32_t kvd_byte_offset;
+        uint32_t kvd_byte_length;
+        uint32_t sgd_byte_range[4]; ///< 64 bit offset and length, unaligned in the file
+    };
+
+    struct Ktx2Level
+    {
+        uint64_t byte_offset;
+        uint64_t byte_length;
+        uint64_t uncompressed_byte_length;
+    };
+
+    static_assert(sizeof(DdsHeader) == 124, "DDS header must match the file layout");
+    static_assert(sizeof(Ktx2Header) == 68, "KTX2 header must match the file layout");
+
+    uint32_t fourCC(const char* code)
+    {
+        return uint32_t(uchar(code[0])) | uint32_t(uchar(code[1])) << 8 | uint32_t(uchar(code[2])) << 16
+               | uint32_t(uchar(code[3])) << 24;
+    }
+
+    /// sRGB variants map to the plain formats, QImage textures aren't linearized either.
+    GLenum formatFromDxgi(uint32_t dxgi_format)
+    {
+        switch (dxgi_format)
+        {
+            case 71: // DXGI_FORMAT_BC1_UNORM
+            case 72: // DXGI_FORMAT_BC1_UNORM_SRGB
+                return COMPRESSED_RGBA_S3TC_DXT1;
+            case 77: // DXGI_FORMAT_BC3_UNORM
+            case 78: // DXGI_FORMAT_BC3_UNORM_SRGB
+                return COMPRESSED_RGBA_S3TC_DXT5;
+            case 83: // DXGI_FORMAT_BC5_UNORM
+                return GL_COMPRESSED_RG_RGTC2;
+            case 98: // DXGI_FORMAT_BC7_UNORM
+            case 99: // DXGI_FORMAT_BC7_UNORM_SRGB
+                return GL_COMPRESSED_RGBA_BPTC_UNORM;
+            default:
+                return 0;
+        }
+    }
+
+    GLenum formatFromVulkan(uint32_t vk_format)
+    {
+        switch (vk_format)
+        {
+            case 131: // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+            case 132: // VK_FORMAT_BC1_RGB_SRGB_BLOCK
+                return COMPRESSED_RGB_S3TC_DXT1;
+            case 133: // VK_FORMAT_BC1_RGBA_UNORM_BLOCK
+            case 134: // VK_FORMAT_BC1_RGBA_SRGB_BLOCK
+                return COMPRESSED_RGBA_S3TC_DXT1;
+            case 137: // VK_FORMAT_BC3_UNORM_BLOCK
+            case 138: // VK_FORMAT_BC3_SRGB_BLOCK
+                return COMPRESSED_RGBA_S3TC_DXT5;
+            case 141: // VK_FORMAT_BC5_UNORM_BLOCK
+                return GL_COMPRESSED_RG_RGTC2;
+            case 145: // VK_FORMAT_BC7_UNORM_BLOCK
+            case 146: // VK_FORMAT_BC7_SRGB_BLOCK
+                return GL_COMPRESSED_RGBA_BPTC_UNORM;
+            default:
+                return 0;
+        }
+    }
+
+    size_t blockSize(GLenum format)
+    {
+        return (COMPRESSED_RGB_S3TC_DXT1 == format || COMPRESSED_RGBA_S3TC_DXT1 == format) ? 8 : 16;
+    }
+}
+
+
+bool CompressedImage::parse(const uchar* data, size_t size)
+{
+    m_format = 0;
+    m_levels.clear();
+
+    if (size >= sizeof(DDS_MAGIC) && 0 == std::memcmp(data, DDS_MAGIC, sizeof(DDS_MAGIC)))
+        return parseDds(data, size);
+    if (size >= sizeof(KTX2_IDENTIFIER) && 0 == std::memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)))
+        return parseKtx2(data, size);
+    return false;
+}
+
+bool CompressedImage::parseDds(const uchar* data, size_t size)
+{
+    size_t offset = sizeof(DDS_MAGIC);
+    if (size < offset + sizeof(DdsHeader))
+        return false;
+
+    DdsHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    offset += sizeof(header);
+    if (sizeof(DdsHeader) != header.size || !(header.pf_flags & DDPF_FOURCC) || (header.caps2 & DDSCAPS2_CUBEMAP))
+        return false;
+
+    if (fourCC("DX10") == header.pf_four_cc)
+    {
+        if (size < offset + sizeof(DdsHeaderDx10))
+            return false;
+
+        DdsHeaderDx10 dx10;
+        std::memcpy(&dx10, data + offset, sizeof(dx10));
+        offset += sizeof(dx10);
+        if (1 != dx10.array_size)
+            return false;
+        m_format = formatFromDxgi(dx10.dxgi_format);
+    }
+    else if (fourCC("DXT1") == header.pf_four_cc)
+    {
+        m_format = COMPRESSED_RGBA_S3TC_DXT1;
+    }
+    else if (fourCC("DXT5") == header.pf_four_cc)
+    {
+        m_format = COMPRESSED_RGBA_S3TC_DXT5;
+    }
+    else if (fourCC("ATI2") == header.pf_four_cc || fourCC("BC5U") == header.pf_four_cc)
+    {
+        m_format = GL_COMPRESSED_RG_RGTC2;
+    }
+    if (0 == m_format)
+        return false;
+    m_block_size = blockSize(m_format);
+
+    const size_t level_count = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header.mip_map_count) : 1;
+    if (!addLevels(level_count, static_cast<GLsizei>(header.width), static_cast<GLsizei>(header.height)))
+        return false;
+
+    // DDS stores the levels back to back, largest first
+    for (Level& level: m_levels)
+    {
+        level.offset = offset;
+        offset += level.size;
+    }
+    return offset <= size;
+}
+
+bool CompressedImage::parseKtx2(const uchar* data, size_t size)
+{
+    size_t offset = sizeof(KTX2_IDENTIFIER);
+    if (size < offset + sizeof(Ktx2Header))
+        return false;
+
+    Ktx2Header header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    offset += sizeof(header);
+    if (0 != header.supercompression_scheme || 1 < header.pixel_depth || 1 < header.layer_count
+        || 1 != header.face_count)
+    {
+        return false;
+    }
+
+    m_format = formatFromVulkan(header.vk_format);
+    if (0 == m_format)
+        return false;
+    m_block_size = blockSize(m_format);
+
+    // a level count of 0 asks for runtime mip generation, which compressed formats can't do
+    const size_t level_count = std::max(1u, header.level_count);
+    if (size < offset + level_count * sizeof(Ktx2Level))
+        return false;
+    if (!addLevels(level_count, static_cast<GLsizei>(header.pixel_width), static_cast<GLsizei>(header.pixel_height)))
+        return false;
+
+    for (Level& level: m_levels)
+    {
+        Ktx2Level index;
+        std::memcpy(&index, data + offset, sizeof(index));
+        offset += sizeof(index);
+
+        if (index.byte_length != level.size || index.byte_offset > size || size - index.byte_offset < level.size)
+            return false;
+        level.offset = static_cast<size_t>(index.byte_offset);
+    }
+    return true;
+}
+
+bool CompressedImage::addLevels(size_t level_count, GLsizei width, GLsizei height)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+
+    size_t max_level_count = 1;
+    while ((std::max(width, height) >> max_level_count) > 0)
+        ++max_level_count;
+    if (level_count > max_level_count)
+        return false;
+
+    for (size_t i = 0; i < level_count; ++i)
+    {
+        const GLsizei level_width = std::max(1, width >> i);
+        const GLsizei level_height = std::max(1, height >> i);
+        const size_t blocks = static_cast<size_t>((level_width + 3) / 4) * static_cast<size_t>((level_height + 3) / 4);
+        m_levels.push_back({0, blocks * m_block_size, level_width, level_height});
+    }
+    return true;
+}
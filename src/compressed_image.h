@@ -0,0 +1,40 @@
+#pragma once
+
+#include <qopengl.h>
+
+#include <cstddef>
+#include <vector>
+
+
+/// Block compressed image with a prebuilt mip chain from a DDS or KTX2 container.
+///
+/// Only 2D BC1, BC3, BC5 and BC7 images are supported. parse() just validates the container and
+/// records where each level lives, the data stays in the caller's buffer.
+class CompressedImage
+{
+public:
+    struct Level
+    {
+        size_t offset; ///< into the parsed buffer
+        size_t size;
+        GLsizei width;
+        GLsizei height;
+    };
+
+    bool parse(const uchar* data, size_t size);
+
+    GLenum format() const { return m_format; }
+    GLsizei width() const { return m_levels.empty() ? 0 : m_levels[0].width; }
+    GLsizei height() const { return m_levels.empty() ? 0 : m_levels[0].height; }
+    const std::vector<Level>& levels() const { return m_levels; }
+
+private:
+    bool parseDds(const uchar* data, size_t size);
+    bool parseKtx2(const uchar* data, size_t size);
+    bool addLevels(size_t level_count, GLsizei width, GLsizei height);
+
+private:
+    GLenum m_format{0};
+    size_t m_block_size{0};
+    std::vector<Level> m_levels;
+};
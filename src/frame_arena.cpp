@@ -0,0 +1,115 @@
+#include "frame_arena.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace
+{
+    const size_t MIN_REGION_SIZE = size_t{1} << 20;
+    const GLuint64 FENCE_TIMEOUT = 1000000000; ///< 1 s, in ns
+}
+
+
+FrameArena::FrameArena() = default;
+
+FrameArena::~FrameArena()
+{
+    destroy();
+}
+
+void FrameArena::initialize()
+{
+    initializeOpenGLFunctions();
+
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_uniform_alignment = std::max<size_t>(static_cast<size_t>(alignment), 16);
+
+    create(MIN_REGION_SIZE);
+}
+
+void FrameArena::beginFrame(size_t size)
+{
+    m_region = (m_region + 1) % REGION_COUNT;
+    m_offset = 0;
+
+    if (size > m_region_size)
+    {
+        // all regions grow together, the old buffer may only go once the GPU is done with all of them
+        destroy();
+        create(std::max(size, 2 * m_region_size));
+        m_region = 0;
+        return;
+    }
+
+    if (m_fences[m_region])
+    {
+        wait(m_fences[m_region]);
+        glDeleteSync(m_fences[m_region]);
+        m_fences[m_region] = nullptr;
+    }
+}
+
+FrameArena::Allocation FrameArena::allocate(size_t size, size_t alignment)
+{
+    m_offset = (m_offset + alignment - 1) / alignment * alignment;
+    assert(m_offset + size <= m_region_size);
+
+    const size_t offset = m_region * m_region_size + m_offset;
+    m_offset += size;
+    return {m_mapped + offset, static_cast<GLintptr>(offset)};
+}
+
+void FrameArena::endFrame()
+{
+    m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void FrameArena::create(size_t region_size)
+{
+    // regions start at multiples of every alignment a caller may ask for
+    m_region_size = (region_size + m_uniform_alignment - 1) / m_uniform_alignment * m_uniform_alignment;
+
+    const auto size = static_cast<GLsizeiptr>(REGION_COUNT * m_region_size);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &m_buffer);
+    glNamedBufferStorage(m_buffer, size, nullptr, flags);
+    m_mapped = static_cast<uchar*>(glMapNamedBufferRange(m_buffer, 0, size, flags));
+}
+
+void FrameArena::destroy()
+{
+    for (GLsync& fence: m_fences)
+    {
+        if (!fence)
+            continue;
+        wait(fence);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (m_buffer)
+    {
+        glUnmapNamedBuffer(m_buffer);
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+        m_mapped = nullptr;
+    }
+}
+
+void FrameArena::wait(GLsync fence)
+{
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (GL_ALREADY_SIGNALED == status || GL_CONDITION_SATISFIED == status)
+        return;
+
+    ++m_stalls;
+    do
+    {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    } while (GL_TIMEOUT_EXPIRED == status);
+    if (GL_WAIT_FAILED == status)
+        qDebug() << "Waiting for a frame arena fence failed";
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <array>
+#include <cstddef>
+
+
+/// Per frame GPU data like instance matrices and uniform blocks in one persistently mapped buffer.
+///
+/// The buffer is split into three regions that take turns. A frame writes its data linearly into
+/// the current region and binds it by offset, then endFrame() fences the region. beginFrame() only
+/// waits if the GPU is still reading the region from three frames ago, and the driver never
+/// copies or orphans anything.
+class FrameArena : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    struct Allocation
+    {
+        uchar* data;     ///< write only, the mapping is coherent
+        GLintptr offset; ///< into getBuffer()
+    };
+
+    FrameArena();
+    ~FrameArena(); ///< needs the GL context to be current
+
+    void initialize();
+
+    /// Starts writing into the next region, which is grown to hold at least size bytes.
+    void beginFrame(size_t size);
+    /// size bytes at a multiple of alignment. The sum of all allocations of the frame including
+    /// their padding must fit into the size given to beginFrame().
+    Allocation allocate(size_t size, size_t alignment);
+    void endFrame();
+
+    GLuint getBuffer() const { return m_buffer; } ///< changes when growing
+    size_t getUniformAlignment() const { return m_uniform_alignment; }
+    size_t getStalls() const { return m_stalls; } ///< frames that waited for the GPU so far
+
+private:
+    static const size_t REGION_COUNT = 3;
+
+    void create(size_t region_size);
+    void destroy();
+    void wait(GLsync fence);
+
+private:
+    GLuint m_buffer{0};
+    uchar* m_mapped{nullptr};
+    size_t m_region_size{0};
+    size_t m_region{0};
+    size_t m_offset{0}; ///< into the current region
+    std::array<GLsync, REGION_COUNT> m_fences{}; ///< of the last frame that used each region
+    size_t m_uniform_alignment{256};
+    size_t m_stalls{0};
+};
@@ -1,5 +1,12 @@
 #include "framebuffer.h"
 
+#include "gl_state.h"
+
+Framebuffer::Framebuffer(GlState& state)
+    : m_state(state)
+{
+}
+
 void Framebuffer::initialize(uint_fast16_t width, uint_fast16_t height)
 {
     initializeOpenGLFunctions();
@@ -9,19 +16,14 @@ void Framebuffer::initialize(uint_fast16_t width, uint_fast16_t height)
 
 void Framebuffer::bind_color_texture()
 {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_fb_col_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_state.bindTextureUnit(0, m_fb_col_id);
 }
 
 void Framebuffer::clear()
 {
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fb_id);
+    m_state.bindDrawFramebuffer(m_fb_id);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // so we can work on a clean empty framebuffer
-    glEnable(GL_DEPTH_TEST);
+    m_state.setCapability(GL_DEPTH_TEST, true);
 }
 
 void Framebuffer::resize(uint_fast16_t width, uint_fast16_t height)
@@ -42,6 +44,10 @@ void Framebuffer::initialize_internal(uint_fast16_t width, uint_fast16_t height)
     glGenTextures(1, &m_fb_col_id);
     glBindTexture(GL_TEXTURE_2D, m_fb_col_id);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // sampler state lives in the texture
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // create framebuffer depth
@@ -4,9 +4,13 @@
 
 #include <QOpenGLFunctions_4_5_Core>
 
+class GlState;
+
 class Framebuffer : protected QOpenGLFunctions_4_5_Core
 {
 public:
+    explicit Framebuffer(GlState& state);
+
     void initialize(uint_fast16_t width, uint_fast16_t height);
 
     void bind_color_texture();
@@ -17,6 +21,7 @@ private:
     void initialize_internal(uint_fast16_t width, uint_fast16_t height);
 
 private:
+    GlState& m_state;
     GLuint m_fb_id;
     GLuint m_fb_col_id;
     GLuint m_fb_depth_id;
@@ -0,0 +1,169 @@
+#include "frustum_culler.h"
+
+#include "bounds.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+
+namespace
+{
+    /// Empty bounds, fail every plane test.
+    const float CULLED_RADIUS = std::numeric_limits<float>::lowest();
+
+    /// Plane coefficients broadcast once per frame.
+    struct PlaneCoefficients
+    {
+        float nx, ny, nz, w;
+        float abs_nx, abs_ny, abs_nz;
+    };
+
+    std::array<PlaneCoefficients, 6> coefficients(const FrustumCuller::Planes& planes)
+    {
+        std::array<PlaneCoefficients, 6> result;
+        for (size_t p = 0; p < planes.size(); ++p)
+        {
+            const QVector4D& plane = planes[p];
+            result[p] = {plane.x(), plane.y(), plane.z(), plane.w(),
+                         std::abs(plane.x()), std::abs(plane.y()), std::abs(plane.z())};
+        }
+        return result;
+    }
+}
+
+
+void FrustumCuller::resize(size_t count)
+{
+    for (std::vector<float>* values:
+         {&m_center_x, &m_center_y, &m_center_z, &m_extent_x, &m_extent_y, &m_extent_z})
+        values->resize(count, 0.0f);
+    m_radius.resize(count, CULLED_RADIUS);
+}
+
+void FrustumCuller::set(size_t index, const BoundingBox& box, const BoundingSphere& sphere)
+{
+    if (box.isEmpty())
+    {
+        for (std::vector<float>* values:
+             {&m_center_x, &m_center_y, &m_center_z, &m_extent_x, &m_extent_y, &m_extent_z})
+            (*values)[index] = 0.0f;
+        m_radius[index] = CULLED_RADIUS;
+        return;
+    }
+
+    const QVector3D center = box.center();
+    const QVector3D extent = box.extent() / 2.0f;
+    m_center_x[index] = center.x();
+    m_center_y[index] = center.y();
+    m_center_z[index] = center.z();
+    m_extent_x[index] = extent.x();
+    m_extent_y[index] = extent.y();
+    m_extent_z[index] = extent.z();
+    // a sphere from Mesh::getBoundingSphere() is centered on the box and needs no widening
+    if (sphere.isEmpty())
+        m_radius[index] = extent.length();
+    else if (sphere.center == center)
+        m_radius[index] = sphere.radius;
+    else
+        m_radius[index] = sphere.radius + (sphere.center - center).length();
+}
+
+void FrustumCuller::cull(const Planes& planes, std::vector<uint32_t>& visible) const
+{
+    visible.clear();
+    cull(planes, 0, size(), visible);
+}
+
+void FrustumCuller::cull(const Planes& planes, size_t begin, size_t end, std::vector<uint32_t>& visible) const
+{
+    const std::array<PlaneCoefficients, 6> plane_coefficients = coefficients(planes);
+    size_t i = begin;
+
+    // an object is outside if it is completely behind a plane: n.c + w < -min(|n|.e, r)
+#if defined(__AVX__)
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= end; i += 8)
+    {
+        const __m256 cx = _mm256_loadu_ps(&m_center_x[i]);
+        const __m256 cy = _mm256_loadu_ps(&m_center_y[i]);
+        const __m256 cz = _mm256_loadu_ps(&m_center_z[i]);
+        const __m256 ex = _mm256_loadu_ps(&m_extent_x[i]);
+        const __m256 ey = _mm256_loadu_ps(&m_extent_y[i]);
+        const __m256 ez = _mm256_loadu_ps(&m_extent_z[i]);
+        const __m256 radius = _mm256_loadu_ps(&m_radius[i]);
+
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (const PlaneCoefficients& p: plane_coefficients)
+        {
+            const __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.nx), cx), _mm256_mul_ps(_mm256_set1_ps(p.ny), cy)),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.nz), cz), _mm256_set1_ps(p.w)));
+            const __m256 box_radius = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.abs_nx), ex), _mm256_mul_ps(_mm256_set1_ps(p.abs_ny), ey)),
+                _mm256_mul_ps(_mm256_set1_ps(p.abs_nz), ez));
+            const __m256 reach = _mm256_add_ps(distance, _mm256_min_ps(box_radius, radius));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(reach, zero, _CMP_GE_OQ));
+        }
+
+        const int mask = _mm256_movemask_ps(inside);
+        for (uint32_t j = 0; j < 8; ++j)
+        {
+            if (mask & (1 << j))
+                visible.push_back(static_cast<uint32_t>(i) + j);
+        }
+    }
+#elif defined(__SSE__) || defined(_M_X64)
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4)
+    {
+        const __m128 cx = _mm_loadu_ps(&m_center_x[i]);
+        const __m128 cy = _mm_loadu_ps(&m_center_y[i]);
+        const __m128 cz = _mm_loadu_ps(&m_center_z[i]);
+        const __m128 ex = _mm_loadu_ps(&m_extent_x[i]);
+        const __m128 ey = _mm_loadu_ps(&m_extent_y[i]);
+        const __m128 ez = _mm_loadu_ps(&m_extent_z[i]);
+        const __m128 radius = _mm_loadu_ps(&m_radius[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (const PlaneCoefficients& p: plane_coefficients)
+        {
+            const __m128 distance =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.nx), cx), _mm_mul_ps(_mm_set1_ps(p.ny), cy)),
+                           _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.nz), cz), _mm_set1_ps(p.w)));
+            const __m128 box_radius =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.abs_nx), ex), _mm_mul_ps(_mm_set1_ps(p.abs_ny), ey)),
+                           _mm_mul_ps(_mm_set1_ps(p.abs_nz), ez));
+            const __m128 reach = _mm_add_ps(distance, _mm_min_ps(box_radius, radius));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(reach, zero));
+        }
+
+        const int mask = _mm_movemask_ps(inside);
+        for (uint32_t j = 0; j < 4; ++j)
+        {
+            if (mask & (1 << j))
+                visible.push_back(static_cast<uint32_t>(i) + j);
+        }
+    }
+#endif
+
+    // the objects that don't fill a whole register, or all of them without SSE
+    for (; i < end; ++i)
+    {
+        bool inside = true;
+        for (const PlaneCoefficients& p: plane_coefficients)
+        {
+            const float distance = p.nx * m_center_x[i] + p.ny * m_center_y[i] + p.nz * m_center_z[i] + p.w;
+            const float box_radius = p.abs_nx * m_extent_x[i] + p.abs_ny * m_extent_y[i] + p.abs_nz * m_extent_z[i];
+            inside = inside && distance + std::min(box_radius, m_radius[i]) >= 0.0f;
+        }
+        if (inside)
+            visible.push_back(static_cast<uint32_t>(i));
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QVector4D>
+
+#include <array>
+#include <cinttypes>
+#include <vector>
+
+struct BoundingBox;
+struct BoundingSphere;
+
+
+/// Tests world space bounds against the view frustum before any GL work is issued.
+///
+/// The bounds are kept as a structure of arrays, the kernel tests four objects at a time with SSE or
+/// eight with AVX. An object is culled if its box or its sphere is completely behind one of the planes.
+class FrustumCuller
+{
+public:
+    using Planes = std::array<QVector4D, 6>; ///< as returned by Camera::getFrustumPlanes()
+
+    /// New entries have empty bounds and are always culled.
+    void resize(size_t count);
+    /// The sphere is tested around the box center, widened to still contain the given sphere.
+    void set(size_t index, const BoundingBox& box, const BoundingSphere& sphere);
+    size_t size() const { return m_radius.size(); }
+
+    /// Indices of the objects that are at least partly inside the frustum.
+    void cull(const Planes& planes, std::vector<uint32_t>& visible) const;
+    /// Appends the visible indices in [begin, end).
+    void cull(const Planes& planes, size_t begin, size_t end, std::vector<uint32_t>& visible) const;
+
+private:
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<float> m_extent_x; ///< half extents of the box
+    std::vector<float> m_extent_y;
+    std::vector<float> m_extent_z;
+    std::vector<float> m_radius;
+};
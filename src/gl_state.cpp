@@ -0,0 +1,119 @@
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace
+{
+    const GLuint UNKNOWN = ~0u; ///< no GL name or enum has this value
+}
+
+
+void GlState::initialize()
+{
+    initializeOpenGLFunctions();
+    beginFrame();
+}
+
+void GlState::beginFrame()
+{
+    m_capabilities.clear();
+    m_blend_func.fill(UNKNOWN);
+    m_depth_mask = UNKNOWN;
+    m_polygon_mode = UNKNOWN;
+    m_viewport.fill(-1);
+    m_draw_framebuffer = UNKNOWN;
+    m_program = UNKNOWN;
+    m_textures.fill(UNKNOWN);
+    m_uniform_buffers.fill(std::tuple<GLuint, GLintptr, GLsizeiptr>(UNKNOWN, 0, 0));
+    m_vertex_array = UNKNOWN;
+    m_statistics = Statistics();
+}
+
+template <typename T>
+bool GlState::change(T& cached, const T& value)
+{
+    if (cached == value)
+    {
+        ++m_statistics.filtered;
+        return false;
+    }
+    cached = value;
+    ++m_statistics.issued;
+    return true;
+}
+
+void GlState::setCapability(GLenum capability, bool enabled)
+{
+    auto it = std::find_if(m_capabilities.begin(), m_capabilities.end(),
+                           [capability](const std::pair<GLenum, bool>& known) { return known.first == capability; });
+    if (m_capabilities.end() == it)
+    {
+        m_capabilities.emplace_back(capability, !enabled);
+        it = m_capabilities.end() - 1;
+    }
+    if (!change(it->second, enabled))
+        return;
+
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+void GlState::blendFunc(GLenum source, GLenum destination)
+{
+    if (change(m_blend_func, {{source, destination}}))
+        glBlendFunc(source, destination);
+}
+
+void GlState::depthMask(bool enabled)
+{
+    if (change(m_depth_mask, enabled ? GLuint{GL_TRUE} : GLuint{GL_FALSE}))
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+}
+
+void GlState::polygonMode(GLenum mode)
+{
+    if (change(m_polygon_mode, mode))
+        glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GlState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (change(m_viewport, {{x, y, width, height}}))
+        glViewport(x, y, width, height);
+}
+
+void GlState::bindDrawFramebuffer(GLuint framebuffer)
+{
+    if (change(m_draw_framebuffer, framebuffer))
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+}
+
+void GlState::useProgram(GLuint program)
+{
+    if (change(m_program, program))
+        glUseProgram(program);
+}
+
+void GlState::bindTextureUnit(GLuint unit, GLuint texture)
+{
+    assert(unit < TEXTURE_UNITS);
+    if (change(m_textures[unit], texture))
+        glBindTextureUnit(unit, texture);
+}
+
+void GlState::bindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    assert(index < UNIFORM_BUFFER_BINDINGS);
+    if (change(m_uniform_buffers[index], std::make_tuple(buffer, offset, size)))
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+}
+
+void GlState::bindVertexArray(GLuint vertex_array)
+{
+    if (change(m_vertex_array, vertex_array))
+        glBindVertexArray(vertex_array);
+}
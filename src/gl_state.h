@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+
+/// Shadow copy of the GL state the renderer changes, so that calls which would set the current
+/// value again never reach the driver.
+///
+/// All modules that draw go through one instance per context. Qt and the texture and mesh uploads
+/// change bindings behind its back, so beginFrame() forgets everything and the first call of each
+/// kind per frame is always issued.
+class GlState : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    /// GL calls of one frame
+    struct Statistics
+    {
+        size_t issued{0};
+        size_t filtered{0}; ///< would have set the current value again
+    };
+
+    void initialize();
+    /// Call before the first tracked call of a frame, after anything that may have changed state.
+    void beginFrame();
+    const Statistics& getStatistics() const { return m_statistics; } ///< since beginFrame()
+
+    void setCapability(GLenum capability, bool enabled); ///< glEnable or glDisable
+    void blendFunc(GLenum source, GLenum destination);
+    void depthMask(bool enabled);
+    void polygonMode(GLenum mode); ///< for front and back faces
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    void bindDrawFramebuffer(GLuint framebuffer);
+    void useProgram(GLuint program);
+    void bindTextureUnit(GLuint unit, GLuint texture);
+    void bindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size); ///< glBindBufferRange
+    void bindVertexArray(GLuint vertex_array);
+
+private:
+    /// Stores value and returns true if it differs from cached.
+    template <typename T>
+    bool change(T& cached, const T& value);
+
+private:
+    static const size_t TEXTURE_UNITS = 16;
+    static const size_t UNIFORM_BUFFER_BINDINGS = 4;
+
+    std::vector<std::pair<GLenum, bool>> m_capabilities; ///< only the known ones
+    std::array<GLenum, 2> m_blend_func;
+    GLuint m_depth_mask; ///< GL_TRUE, GL_FALSE or unknown
+    GLenum m_polygon_mode;
+    std::array<GLint, 4> m_viewport;
+    GLuint m_draw_framebuffer;
+    GLuint m_program;
+    std::array<GLuint, TEXTURE_UNITS> m_textures;
+    std::array<std::tuple<GLuint, GLintptr, GLsizeiptr>, UNIFORM_BUFFER_BINDINGS> m_uniform_buffers;
+    GLuint m_vertex_array;
+
+    Statistics m_statistics;
+};
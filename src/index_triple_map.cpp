@@ -0,0 +1,73 @@
+#include "index_triple_map.h"
+
+#include <limits>
+
+
+namespace
+{
+    const uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+    const size_t MIN_SLOT_COUNT = 16;
+
+    /// keeps the load factor at or below 3/4
+    size_t slotCountFor(size_t key_count)
+    {
+        size_t count = MIN_SLOT_COUNT;
+        while (count - count / 4 < key_count)
+            count *= 2;
+        return count;
+    }
+}
+
+
+IndexTripleMap::IndexTripleMap(size_t expected_size)
+{
+    rehash(slotCountFor(expected_size));
+}
+
+std::pair<uint32_t, bool> IndexTripleMap::emplace(const std::array<int, 3>& key, uint32_t value)
+{
+    if (m_size + 1 > m_slots.size() - m_slots.size() / 4)
+        rehash(2 * m_slots.size());
+
+    for (size_t i = hash(key) & m_mask;; i = (i + 1) & m_mask)
+    {
+        Slot& slot = m_slots[i];
+        if (EMPTY_SLOT == slot.value)
+        {
+            slot.key = key;
+            slot.value = value;
+            ++m_size;
+            return {value, true};
+        }
+        if (slot.key == key)
+            return {slot.value, false};
+    }
+}
+
+size_t IndexTripleMap::hash(const std::array<int, 3>& key)
+{
+    // combine with distinct odd multipliers so that permutations differ, then finalize like murmur3
+    uint64_t h = static_cast<uint32_t>(key[0]) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint32_t>(key[1]) * 0xC2B2AE3D27D4EB4Full;
+    h ^= static_cast<uint32_t>(key[2]) * 0x165667B19E3779F9ull;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+void IndexTripleMap::rehash(size_t slot_count)
+{
+    std::vector<Slot> old_slots(slot_count, Slot{{0, 0, 0}, EMPTY_SLOT});
+    old_slots.swap(m_slots);
+    m_mask = slot_count - 1;
+    m_size = 0;
+
+    for (const Slot& slot: old_slots)
+    {
+        if (EMPTY_SLOT != slot.value)
+            emplace(slot.key, slot.value);
+    }
+}
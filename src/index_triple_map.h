@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+/// Flat open addressing map from OBJ {vertex, texcoord, normal} index triples to mesh vertex indices.
+///
+/// Slots live in a single array probed linearly, so inserting a unique vertex never allocates.
+/// The table is sized up front for the expected number of keys and only grows if that is exceeded.
+class IndexTripleMap
+{
+public:
+    explicit IndexTripleMap(size_t expected_size);
+
+    /// Returns the index stored for key and false, or inserts value and returns it and true.
+    std::pair<uint32_t, bool> emplace(const std::array<int, 3>& key, uint32_t value);
+    size_t size() const { return m_size; }
+    size_t memoryUsage() const { return m_slots.capacity() * sizeof(Slot); }
+
+private:
+    struct Slot
+    {
+        std::array<int, 3> key;
+        uint32_t value; ///< EMPTY_SLOT for unused slots
+    };
+
+    static size_t hash(const std::array<int, 3>& key);
+    void rehash(size_t slot_count);
+
+private:
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    size_t m_size{0};
+};
@@ -0,0 +1,208 @@
+#include "instanced_renderer.h"
+
+#include "gl_state.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "shape.h"
+#include "texture.h"
+
+#include <QVector4D>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+
+namespace
+{
+    /// std140 layout of the UniformsForVS block
+    struct VertexUniforms
+    {
+        float view_projection[16];
+        float texcoord_transform[4]; ///< offset xy, scale zw of quantized texcoords
+    };
+
+    const size_t MATRIX_SIZE = 16 * sizeof(float);
+
+    // material fields from the most significant bits down: programs are the most expensive to switch,
+    // then textures, then vertex arrays. Pipelines sharing a program only differ in their raster state.
+    const int SHADER_BITS = 8;
+    const int TEXTURE_BITS = 14;
+    const int MESH_BITS = 14;
+    const int LOD_BITS = 2;
+    const int PIPELINE_BITS = 4;
+    const int PIPELINE_SHIFT = 0;
+    const int LOD_SHIFT = PIPELINE_SHIFT + PIPELINE_BITS;
+    const int MESH_SHIFT = LOD_SHIFT + LOD_BITS;
+    const int TEXTURE_SHIFT = MESH_SHIFT + MESH_BITS;
+    const int SHADER_SHIFT = TEXTURE_SHIFT + TEXTURE_BITS;
+    const int MATERIAL_BITS = SHADER_SHIFT + SHADER_BITS;
+
+    // sort keys start with the pass. Opaque keys continue with the material and end with the depth, so
+    // batches draw front to back within. Transparent keys put the depth first, far to near, and
+    // only batch neighbours that happen to share a material.
+    const int PASS_SHIFT = 63;
+    const int DEPTH_BITS = PASS_SHIFT - MATERIAL_BITS;
+    const uint64_t DEPTH_MASK = (uint64_t{1} << DEPTH_BITS) - 1;
+
+    const int RADIX_BITS = 8;
+    const size_t RADIX_SIZE = size_t{1} << RADIX_BITS;
+
+    /// Order preserving bits of a non-negative depth, its float representation without the low mantissa bits.
+    uint64_t depthBits(float depth)
+    {
+        uint32_t bits;
+        const float clamped = std::max(depth, 0.0f);
+        std::memcpy(&bits, &clamped, sizeof(bits));
+        return bits >> (32 - DEPTH_BITS);
+    }
+}
+
+
+InstancedRenderer::InstancedRenderer(GlState& state)
+    : m_state(state)
+{
+}
+
+InstancedRenderer::~InstancedRenderer() = default;
+
+void InstancedRenderer::initialize()
+{
+    initializeOpenGLFunctions();
+    m_arena.initialize();
+}
+
+void InstancedRenderer::add(const RenderObject& object, size_t lod)
+{
+    m_instances.push_back({object.getMesh(), object.getPipeline(), object.getTexture(), lod, object.isTransparent(),
+                           object.getInstanceMatrix(), object.getBoundingSphere().center});
+}
+
+uint64_t InstancedRenderer::getId(std::unordered_map<const void*, uint64_t>& ids, const void* object)
+{
+    return ids.emplace(object, ids.size()).first->second;
+}
+
+bool InstancedRenderer::sameBatch(const Instance& lhs, const Instance& rhs)
+{
+    return lhs.mesh == rhs.mesh && lhs.pipeline == rhs.pipeline && lhs.texture == rhs.texture && lhs.lod == rhs.lod;
+}
+
+void InstancedRenderer::radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch)
+{
+    scratch.resize(items.size());
+    for (int shift = 0; shift < 64; shift += RADIX_BITS)
+    {
+        size_t offsets[RADIX_SIZE] = {};
+        for (const SortItem& item: items)
+            ++offsets[(item.key >> shift) & (RADIX_SIZE - 1)];
+        if (items.size() == offsets[(items[0].key >> shift) & (RADIX_SIZE - 1)])
+            continue;
+
+        size_t sum = 0;
+        for (size_t& offset: offsets)
+        {
+            const size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+        for (const SortItem& item: items)
+            scratch[offsets[(item.key >> shift) & (RADIX_SIZE - 1)]++] = item;
+        items.swap(scratch);
+    }
+}
+
+void InstancedRenderer::draw(const QMatrix4x4& pv)
+{
+    m_statistics = Statistics();
+    if (m_instances.empty())
+        return;
+
+    // ids beyond a field's range share its largest value, such instances still draw correctly
+    // but may split into more batches
+    const auto field = [](uint64_t value, int bits, int shift) {
+        return std::min(value, (uint64_t{1} << bits) - 1) << shift;
+    };
+    const QVector4D depth_row = pv.row(3);
+    m_order.resize(m_instances.size());
+    for (size_t i = 0; i < m_instances.size(); ++i)
+    {
+        const Instance& instance = m_instances[i];
+        const float depth = QVector4D::dotProduct(depth_row, QVector4D(instance.center, 1.0f));
+        const uint64_t material = field(getId(m_shader_ids, instance.pipeline->getProgram().get()), SHADER_BITS,
+                                        SHADER_SHIFT)
+                                  | field(getId(m_texture_ids, instance.texture), TEXTURE_BITS, TEXTURE_SHIFT)
+                                  | field(getId(m_mesh_ids, instance.mesh), MESH_BITS, MESH_SHIFT)
+                                  | field(instance.lod, LOD_BITS, LOD_SHIFT)
+                                  | field(getId(m_pipeline_ids, instance.pipeline), PIPELINE_BITS, PIPELINE_SHIFT);
+        if (instance.transparent)
+        {
+            m_order[i].key = uint64_t{1} << PASS_SHIFT | (DEPTH_MASK - depthBits(depth)) << MATERIAL_BITS | material;
+        }
+        else
+        {
+            m_order[i].key = material << DEPTH_BITS | depthBits(depth);
+        }
+        m_order[i].instance = static_cast<uint32_t>(i);
+    }
+    m_shader_ids.clear();
+    m_pipeline_ids.clear();
+    m_texture_ids.clear();
+    m_mesh_ids.clear();
+    radixSort(m_order, m_sort_scratch);
+
+    // every batch writes at most one uniform block, so the frame's size is known up front
+    const size_t uniform_alignment = m_arena.getUniformAlignment();
+    const size_t uniform_stride = (sizeof(VertexUniforms) + uniform_alignment - 1) / uniform_alignment
+                                  * uniform_alignment;
+    m_arena.beginFrame(m_order.size() * (MATRIX_SIZE + uniform_stride) + uniform_alignment);
+
+    const FrameArena::Allocation matrices = m_arena.allocate(m_order.size() * MATRIX_SIZE, 16);
+    for (size_t i = 0; i < m_order.size(); ++i)
+        std::memcpy(matrices.data + i * MATRIX_SIZE, m_instances[m_order[i].instance].matrix.constData(), MATRIX_SIZE);
+
+    VertexUniforms uniforms;
+    std::memcpy(uniforms.view_projection, pv.constData(), sizeof(uniforms.view_projection));
+
+    // all programs read the same block, a new one is only written when the mesh's texcoord transform changes
+    const std::array<float, 4>* texcoord_transform = nullptr;
+    Mesh* mesh = nullptr;
+    for (size_t begin = 0; begin < m_order.size();)
+    {
+        const Instance& batch = m_instances[m_order[begin].instance];
+        size_t end = begin + 1;
+        while (end < m_order.size() && sameBatch(batch, m_instances[m_order[end].instance]))
+            ++end;
+
+        batch.pipeline->bind(m_state);
+        if (!texcoord_transform || *texcoord_transform != batch.mesh->getTexCoordTransform())
+        {
+            texcoord_transform = &batch.mesh->getTexCoordTransform();
+            std::memcpy(uniforms.texcoord_transform, texcoord_transform->data(), sizeof(uniforms.texcoord_transform));
+            const FrameArena::Allocation block = m_arena.allocate(sizeof(uniforms), uniform_alignment);
+            std::memcpy(block.data, &uniforms, sizeof(uniforms));
+            m_state.bindUniformBuffer(0, m_arena.getBuffer(), block.offset, sizeof(uniforms));
+            ++m_statistics.uniform_blocks;
+        }
+        if (batch.texture)
+            batch.texture->bind(m_state);
+        else
+            m_state.bindTextureUnit(0, 0);
+        // batches find their matrices through the base instance, so the buffer binding stays the same
+        if (batch.mesh != mesh)
+        {
+            batch.mesh->setInstanceBuffer(m_arena.getBuffer(), matrices.offset);
+            mesh = batch.mesh;
+        }
+        batch.mesh->bind(m_state);
+
+        batch.mesh->draw(batch.lod, static_cast<GLsizei>(end - begin), static_cast<GLuint>(begin));
+
+        ++m_statistics.batches;
+        begin = end;
+    }
+    m_arena.endFrame();
+
+    m_instances.clear();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QMatrix4x4>
+#include <QOpenGLFunctions_4_5_Core>
+#include <QVector3D>
+
+#include <cinttypes>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "frame_arena.h"
+
+
+class GlState;
+class Mesh;
+class Pipeline;
+class RenderObject;
+class Texture;
+
+
+/// Draws render objects with one instanced draw per mesh, level of detail, pipeline and texture.
+///
+/// Objects are queued with add() every frame. draw() radix sorts them by a 64 bit key of pass,
+/// shader, texture, mesh, level of detail, pipeline and view depth, uploads the per-instance
+/// matrices of all batches into a single buffer and issues one instanced draw per batch and draw
+/// range of the mesh. Matrices and uniform blocks are written straight into a FrameArena and bound
+/// by offset. Opaque objects are drawn first, front to back and without blending, then the
+/// transparent ones back to front. All state changes go through the GlState, which drops the ones between batches that
+/// share a program, texture, vertex array or render state.
+class InstancedRenderer : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    explicit InstancedRenderer(GlState& state);
+    ~InstancedRenderer();
+
+    /// GL work of one draw(), binds and render state changes are counted by the GlState
+    struct Statistics
+    {
+        size_t batches{0};
+        size_t uniform_blocks{0}; ///< written to the frame arena
+    };
+
+    void initialize();
+
+    void add(const RenderObject& object, size_t lod);
+    void draw(const QMatrix4x4& pv); ///< draws and clears the queue
+
+    const Statistics& getStatistics() const { return m_statistics; } ///< of the last draw()
+
+private:
+    struct Instance
+    {
+        Mesh* mesh;
+        const Pipeline* pipeline;
+        Texture* texture;
+        size_t lod;
+        bool transparent; ///< blended by the pipeline
+        QMatrix4x4 matrix; ///< model matrix including the mesh dequantization
+        QVector3D center;  ///< of the world space bounds, for the depth order
+    };
+
+    struct SortItem
+    {
+        uint64_t key;
+        uint32_t instance;
+    };
+
+    /// Small per frame id of a shader, pipeline, texture or mesh, in order of first use.
+    static uint64_t getId(std::unordered_map<const void*, uint64_t>& ids, const void* object);
+    static bool sameBatch(const Instance& lhs, const Instance& rhs);
+    /// Least significant digit first, skips the digits that are the same for all items.
+    static void radixSort(std::vector<SortItem>& items, std::vector<SortItem>& scratch);
+
+private:
+    GlState& m_state;
+    std::vector<Instance> m_instances;
+    std::vector<SortItem> m_order;
+    std::vector<SortItem> m_sort_scratch;
+    std::unordered_map<const void*, uint64_t> m_shader_ids; ///< cleared by draw(), like the ones below
+    std::unordered_map<const void*, uint64_t> m_pipeline_ids;
+    std::unordered_map<const void*, uint64_t> m_texture_ids;
+    std::unordered_map<const void*, uint64_t> m_mesh_ids;
+    FrameArena m_arena; ///< instance matrices in batch order, then the uniform blocks
+    Statistics m_statistics;
+};
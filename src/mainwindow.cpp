@@ -5,6 +5,8 @@
 #include "opengl_window.h"
 #include "util.h"
 
+#include <QDebug>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QKeyEvent>
@@ -19,6 +21,7 @@ MainWindow::MainWindow(QWidget* parent /*=0*/)
   , m_input_manager{std::make_unique<InputManager>()}
   , m_main_loop_time{std::make_unique<QTime>()}
   , m_ui{std::make_unique<Ui::MainWindow>()}
+  , m_left_mouse_action{new QAction{this}}
   , m_right_mouse_action{new QAction{this}}
 {
     m_ui->setupUi(this);
@@ -41,11 +44,15 @@ MainWindow::MainWindow(QWidget* parent /*=0*/)
     connect(m_ui->buttonWireFrame, &QPushButton::clicked, m_glWindow.get(), &OpenGLWindow::showWireFrame);
 
     connect(m_glWindow.get(), &OpenGLWindow::frameTime, this, &MainWindow::showFrameTime);
+    connect(m_glWindow.get(), &OpenGLWindow::objectsCulled, this, &MainWindow::showCulledObjects);
+    connect(m_glWindow.get(), &OpenGLWindow::renderStatistics, this, &MainWindow::showRenderStatistics);
 
     installEventFilter(m_input_manager.get());
     // the OpenGLWindow is not really part of the hierarchy so we need to make sure it does not swallow events
     m_glWindow->installEventFilter(m_input_manager.get());
 
+    connect(m_left_mouse_action, &QAction::triggered, this, &MainWindow::onLeftMouseButtonPress);
+    m_input_manager->registerAction(Qt::LeftButton, m_left_mouse_action);
     connect(m_right_mouse_action, &QAction::triggered, this, &MainWindow::onRightMouseButtonPress);
     m_input_manager->registerAction(Qt::RightButton, m_right_mouse_action);
 
@@ -61,12 +68,24 @@ MainWindow::MainWindow(QWidget* parent /*=0*/)
 
 MainWindow::~MainWindow() = default;
 
+void MainWindow::showCulledObjects(int visible, int culled)
+{
+    m_ui->cullingLabel->setText(QString("%1 / %2 culled").arg(visible).arg(culled));
+}
+
 void MainWindow::showFrameTime(float time_in_ms)
 {
     const QString text = QString("%1 ms").arg(time_in_ms);
     m_ui->frameTimeLabel->setText(text);
 }
 
+void MainWindow::showRenderStatistics(int batches, int issued_gl_calls, int filtered_gl_calls)
+{
+    const int requested_gl_calls = issued_gl_calls + filtered_gl_calls;
+    m_ui->renderStatisticsLabel->setText(
+        QString("%1 draws, %2 / %3 GL calls").arg(batches).arg(issued_gl_calls).arg(requested_gl_calls));
+}
+
 void MainWindow::main_loop()
 {
     if (m_main_loop_time->elapsed() < 16) // game loop runs at vsync rate for now
@@ -142,6 +161,29 @@ void MainWindow::on_actionLoadObject_triggered()
     m_glWindow->loadObject(obj_file);
 }
 
+void MainWindow::on_actionCancelLoading_triggered()
+{
+    m_glWindow->cancelLoading();
+}
+
+void MainWindow::onLeftMouseButtonPress()
+{
+    if (QEvent::MouseButtonPress != m_left_mouse_action->data())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    OpenGLWindow::PickResult result;
+    const bool hit = m_glWindow->pick(m_glWindow->mapFromGlobal(QCursor::pos()), result);
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    if (hit)
+        qDebug() << "Picked object" << result.object << "triangle" << result.triangle << "at" << result.position
+                 << "in" << elapsed / 1000 << "us";
+    else
+        qDebug() << "Picked nothing in" << elapsed / 1000 << "us";
+}
+
 void MainWindow::onRightMouseButtonPress()
 {
     if (QEvent::MouseButtonPress == m_right_mouse_action->data())
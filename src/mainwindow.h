@@ -22,14 +22,18 @@ public:
     ~MainWindow() override;
 
 private:
+    void showCulledObjects(int visible, int culled);
     void showFrameTime(float time_in_ms);
+    void showRenderStatistics(int batches, int issued_gl_calls, int filtered_gl_calls);
     void updateCameraRotation();
     void updateCameraTranslation();
 
 private slots:
     void main_loop();
 
+    void onLeftMouseButtonPress(); ///< picks the object under the cursor
     void onRightMouseButtonPress();
+    void on_actionCancelLoading_triggered();
     void on_actionLoadObject_triggered();
 
 private:
@@ -38,6 +42,7 @@ private:
     std::unique_ptr<QTime> m_main_loop_time;
     std::unique_ptr<Ui::MainWindow> m_ui;
 
+    QAction* m_left_mouse_action;
     QAction* m_right_mouse_action;
 
 private: // temps
@@ -1,95 +1,378 @@
 #include "mesh.h"
 
+#include "gl_state.h"
+#include "mesh_simplifier.h"
 #include "util.h"
 
+#include <QDebug>
+#include <QOpenGLContext>
+
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <math.h>
+#include <numeric>
+#include <tuple>
+
+
+namespace
+{
+    // fixed attribute locations, they match the layout qualifiers of all shaders
+    const GLuint POSITION_LOCATION = 0;
+    const GLuint NORMAL_LOCATION = 1;
+    const GLuint TEXCOORD_LOCATION = 2;
+    const GLuint INSTANCE_MATRIX_LOCATION = 3; ///< mat4, takes up locations 3 to 6
+
+    const GLuint VERTEX_BINDING = 0;
+    const GLuint INSTANCE_BINDING = 1;
+
+    struct VertexLayout
+    {
+        GLuint position_size;
+        GLuint normal_size;
+        GLuint texcoord_size;
+        GLenum position_type;
+        GLint normal_components;
+        GLenum normal_type;
+        GLenum texcoord_type;
+        GLboolean normalized;
+    };
+
+    const VertexLayout FLOAT_LAYOUT = {12, 12, 8, GL_FLOAT, 3, GL_FLOAT, GL_FLOAT, GL_FALSE};
+
+    /// unorm16 positions (padded to 8 bytes), snorm 10_10_10_2 normals and unorm16 texcoords
+    const VertexLayout QUANTIZED_LAYOUT = {8, 4, 4, GL_UNSIGNED_SHORT, 4, GL_INT_2_10_10_10_REV, GL_UNSIGNED_SHORT,
+                                           GL_TRUE};
+
+    const size_t SHORT_INDEX_RANGE = size_t{1} << 16;
+    const size_t MIN_FACES_PER_CHUNK = 1024; ///< below that 32 bit indices are cheaper than extra draw calls
+
+    struct DrawChunk
+    {
+        size_t first_face;
+        size_t face_count;
+        uint32_t base_vertex;
+    };
+
+    /// Splits faces into runs that each reference less than 65536 consecutive vertices, so that
+    /// they can be drawn with 16 bit indices and a base vertex. Empty if that isn't worth it.
+    std::vector<DrawChunk> splitForShortIndices(const std::vector<std::array<uint32_t, 3>>& faces,
+                                                size_t vertex_count)
+    {
+        if (faces.empty())
+            return {};
+        if (vertex_count <= SHORT_INDEX_RANGE)
+            return {{0, faces.size(), 0}};
+
+        std::vector<DrawChunk> chunks;
+        uint32_t min_index = UINT32_MAX;
+        uint32_t max_index = 0;
+        size_t first_face = 0;
+        for (size_t f = 0; f < faces.size(); ++f)
+        {
+            const auto minmax = std::minmax({faces[f][0], faces[f][1], faces[f][2]});
+            const uint32_t new_min = std::min(min_index, minmax.first);
+            const uint32_t new_max = std::max(max_index, minmax.second);
+            if (new_max - new_min >= SHORT_INDEX_RANGE)
+            {
+                chunks.push_back({first_face, f - first_face, min_index});
+                first_face = f;
+                min_index = minmax.first;
+                max_index = minmax.second;
+            }
+            else
+            {
+                min_index = new_min;
+                max_index = new_max;
+            }
+        }
+        chunks.push_back({first_face, faces.size() - first_face, min_index});
+
+        if (chunks.size() > faces.size() / MIN_FACES_PER_CHUNK)
+            return {};
+        return chunks;
+    }
+
+    const float LOD_RATIOS[] = {0.5f, 0.25f, 0.125f}; ///< target face counts relative to the full mesh
+    const float LOD_MAX_ERROR = 0.05f;                 ///< relative to the bounding box half diagonal
+    const size_t MIN_LOD_FACES = 256;                  ///< smaller levels aren't worth another draw range
+    const float MIN_LOD_REDUCTION = 0.9f; ///< a level has to drop at least 10% of the faces of the previous one
+
+    uint16_t quantizeUnorm16(float value)
+    {
+        return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+    }
+
+    uint32_t packSnorm10(float value)
+    {
+        const long quantized = std::lround(std::min(std::max(value, -1.0f), 1.0f) * 511.0f);
+        return static_cast<uint32_t>(quantized) & 0x3FF;
+    }
+
+    template <typename T>
+    void remapVertices(std::vector<T>& data, const std::vector<uint32_t>& remap, size_t vertex_count)
+    {
+        if (data.empty())
+            return;
+        // attributes only some vertices have can't be matched to them, the mesh ignores them anyway
+        if (data.size() != remap.size())
+        {
+            data.clear();
+            return;
+        }
+
+        std::vector<T> remapped(vertex_count, data[0]);
+        for (size_t i = 0; i < remap.size(); ++i)
+        {
+            if (remap[i] < vertex_count)
+                remapped[remap[i]] = data[i];
+        }
+        data.swap(remapped);
+    }
+}
 
 
 Mesh::Mesh()
-    : m_index_buffer{0}
-    , m_normal_buffer{0}
-    , m_position_buffer{0}
-    , m_texcoord_buffer{0}
+    : m_vao{0}
+    , m_vertex_buffer{0}
+    , m_index_buffer{0}
+    , m_index_type{GL_UNSIGNED_INT}
 {
-    initializeOpenGLFunctions();
+}
+
+Mesh::~Mesh()
+{
+    // shared meshes die with their last render object, that is on the render thread
+    if (m_vao && QOpenGLContext::currentContext())
+    {
+        glDeleteVertexArrays(1, &m_vao);
+        glDeleteBuffers(1, &m_vertex_buffer);
+        glDeleteBuffers(1, &m_index_buffer);
+    }
 }
 
 void Mesh::initVBOs()
 {
-    glGenBuffers(1, &m_position_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_position_buffer);
-    glBufferData(GL_ARRAY_BUFFER, m_positions.size() * sizeof(m_positions[0]), m_positions.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // shared meshes are initialized by each of their render objects
+    if (m_vao)
+        return;
+
+    // meshes may be built on loader threads, so GL is only resolved once we are on the render thread
+    initializeOpenGLFunctions();
 
-    glGenBuffers(1, &m_index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(m_indices[0]), m_indices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    const bool has_normals = hasNormals();
+    const bool has_texcoords = hasTexCoords();
+    if (has_normals == m_normals.empty() || has_texcoords == m_texcoords.empty())
+        qDebug() << "Ignoring normals or texcoords that not all vertices have";
+
+    // position | normal | texcoord, attributes a mesh doesn't have are left out
+    const VertexLayout layout = m_quantize_vertices ? QUANTIZED_LAYOUT : FLOAT_LAYOUT;
+    const GLuint normal_offset = layout.position_size;
+    const GLuint texcoord_offset = normal_offset + (has_normals ? layout.normal_size : 0);
+    const GLuint stride = texcoord_offset + (has_texcoords ? layout.texcoord_size : 0);
+
+    std::vector<uchar> vertices(m_positions.size() * stride);
+    if (m_quantize_vertices)
+        writeQuantizedVertices(vertices.data(), stride, normal_offset, texcoord_offset);
+    else
+        writeFloatVertices(vertices.data(), stride, normal_offset, texcoord_offset);
+
+    // all levels of detail share the vertex buffer and follow each other in the index buffer
+    std::vector<const std::vector<std::array<uint32_t, 3>>*> levels{&m_indices};
+    for (const Lod& lod: m_lods)
+        levels.push_back(&lod.faces);
+
+    std::vector<std::vector<DrawChunk>> chunks;
+    bool short_indices = true;
+    size_t face_count = 0;
+    for (const auto* faces: levels)
+    {
+        chunks.push_back(splitForShortIndices(*faces, m_positions.size()));
+        short_indices = short_indices && (faces->empty() || !chunks.back().empty());
+        face_count += faces->size();
+    }
+
+    m_index_type = short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const size_t index_size = short_indices ? sizeof(uint16_t) : sizeof(uint32_t);
+    std::vector<uchar> indices(3 * face_count * index_size);
+    m_draw_ranges.assign(levels.size(), {});
+    size_t first_index = 0;
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        const std::vector<std::array<uint32_t, 3>>& faces = *levels[l];
+        if (!short_indices)
+        {
+            std::memcpy(indices.data() + first_index * index_size, faces.data(), faces.size() * sizeof(faces[0]));
+            m_draw_ranges[l].push_back({3 * static_cast<GLsizei>(faces.size()), first_index * index_size, 0});
+        }
+        else
+        {
+            uint16_t* out = reinterpret_cast<uint16_t*>(indices.data()) + first_index;
+            for (const DrawChunk& chunk: chunks[l])
+            {
+                for (size_t f = chunk.first_face; f < chunk.first_face + chunk.face_count; ++f)
+                {
+                    for (uint32_t v: faces[f])
+                        *out++ = static_cast<uint16_t>(v - chunk.base_vertex);
+                }
+                m_draw_ranges[l].push_back({3 * static_cast<GLsizei>(chunk.face_count),
+                                            (first_index + 3 * chunk.first_face) * sizeof(uint16_t),
+                                            static_cast<GLint>(chunk.base_vertex)});
+            }
+        }
+        first_index += 3 * faces.size();
+    }
+
+    m_gpu_memory = vertices.size() + indices.size();
+    m_uncompressed_gpu_memory = m_positions.size() * (FLOAT_LAYOUT.position_size
+                                                      + (has_normals ? FLOAT_LAYOUT.normal_size : 0)
+                                                      + (has_texcoords ? FLOAT_LAYOUT.texcoord_size : 0))
+                                + face_count * sizeof(m_indices[0]);
+
+    glCreateVertexArrays(1, &m_vao);
+
+    // immutable storage can't be empty
+    if (!vertices.empty() && !indices.empty())
+    {
+        glCreateBuffers(1, &m_vertex_buffer);
+        glNamedBufferStorage(m_vertex_buffer, vertices.size(), vertices.data(), 0);
+        glCreateBuffers(1, &m_index_buffer);
+        glNamedBufferStorage(m_index_buffer, indices.size(), indices.data(), 0);
+
+        glVertexArrayVertexBuffer(m_vao, VERTEX_BINDING, m_vertex_buffer, 0, static_cast<GLsizei>(stride));
+        glVertexArrayElementBuffer(m_vao, m_index_buffer);
+    }
+
+    glEnableVertexArrayAttrib(m_vao, POSITION_LOCATION);
+    glVertexArrayAttribFormat(m_vao, POSITION_LOCATION, 3, layout.position_type, layout.normalized, 0);
+    glVertexArrayAttribBinding(m_vao, POSITION_LOCATION, VERTEX_BINDING);
+
+    if (has_normals)
+    {
+        glEnableVertexArrayAttrib(m_vao, NORMAL_LOCATION);
+        glVertexArrayAttribFormat(m_vao, NORMAL_LOCATION, layout.normal_components, layout.normal_type,
+                                  layout.normalized, normal_offset);
+        glVertexArrayAttribBinding(m_vao, NORMAL_LOCATION, VERTEX_BINDING);
+    }
+
+    if (has_texcoords)
+    {
+        glEnableVertexArrayAttrib(m_vao, TEXCOORD_LOCATION);
+        glVertexArrayAttribFormat(m_vao, TEXCOORD_LOCATION, 2, layout.texcoord_type, layout.normalized,
+                                  texcoord_offset);
+        glVertexArrayAttribBinding(m_vao, TEXCOORD_LOCATION, VERTEX_BINDING);
+    }
 
-    if (0 < m_normals.size())
+    // one column major model matrix per instance, the buffer is attached right before drawing
+    for (GLuint column = 0; column < 4; ++column)
     {
-        assert(m_normals.size() == m_positions.size());
-        glGenBuffers(1, &m_normal_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, m_normal_buffer);
-        glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(m_normals[0]), m_normals.data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glEnableVertexArrayAttrib(m_vao, INSTANCE_MATRIX_LOCATION + column);
+        glVertexArrayAttribFormat(m_vao, INSTANCE_MATRIX_LOCATION + column, 4, GL_FLOAT, GL_FALSE,
+                                  column * 4 * sizeof(GLfloat));
+        glVertexArrayAttribBinding(m_vao, INSTANCE_MATRIX_LOCATION + column, INSTANCE_BINDING);
     }
+    glVertexArrayBindingDivisor(m_vao, INSTANCE_BINDING, 1);
+}
 
-    if (0 < m_texcoords.size())
+void Mesh::writeFloatVertices(uchar* out, size_t stride, size_t normal_offset, size_t texcoord_offset) const
+{
+    const bool has_normals = hasNormals();
+    const bool has_texcoords = hasTexCoords();
+    for (size_t i = 0; i < m_positions.size(); ++i, out += stride)
     {
-        assert(m_texcoords.size() == m_positions.size());
-        glGenBuffers(1, &m_texcoord_buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, m_texcoord_buffer);
-        glBufferData(GL_ARRAY_BUFFER, m_texcoords.size() * sizeof(m_texcoords[0]), m_texcoords.data(), GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        std::memcpy(out, &m_positions[i], sizeof(Vec3D));
+        if (has_normals)
+            std::memcpy(out + normal_offset, &m_normals[i], sizeof(Vec3D));
+        if (has_texcoords)
+        {
+            const float texcoord[2] = {m_texcoords[i].first, m_texcoords[i].second};
+            std::memcpy(out + texcoord_offset, texcoord, sizeof(texcoord));
+        }
     }
 }
 
-void Mesh::bindBuffers(const int position_location, const int normal_location, const int texcoord_location)
+void Mesh::writeQuantizedVertices(uchar* out, size_t stride, size_t normal_offset, size_t texcoord_offset)
 {
-    assert(-1 != position_location);
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, m_position_buffer);
-    glVertexAttribPointer(position_location, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    // positions and texcoords are stored relative to their bounds, the inverse transform is applied
+    // through the model matrix and the texcoord_transform uniform
+    const BoundingBox& bounds = getBoundingBox();
+    for (int c = 0; c < 3; ++c)
+    {
+        const float position_min = bounds.isEmpty() ? 0.0f : bounds.min[c];
+        const float position_max = bounds.isEmpty() ? 0.0f : bounds.max[c];
+        m_position_offset[c] = position_min;
+        m_position_scale[c] = position_max > position_min ? position_max - position_min : 1.0f;
+    }
 
-    if (0 < m_normal_buffer && -1 != normal_location)
+    const bool has_normals = hasNormals();
+    const bool has_texcoords = hasTexCoords();
+    float texcoord_min[2] = {0.0f, 0.0f};
+    float texcoord_max[2] = {1.0f, 1.0f};
+    if (has_texcoords)
     {
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, m_normal_buffer);
-        glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+        texcoord_min[0] = texcoord_max[0] = m_texcoords[0].first;
+        texcoord_min[1] = texcoord_max[1] = m_texcoords[0].second;
+        for (const auto& t: m_texcoords)
+        {
+            texcoord_min[0] = std::min(texcoord_min[0], t.first);
+            texcoord_min[1] = std::min(texcoord_min[1], t.second);
+            texcoord_max[0] = std::max(texcoord_max[0], t.first);
+            texcoord_max[1] = std::max(texcoord_max[1], t.second);
+        }
+    }
+    for (int c = 0; c < 2; ++c)
+    {
+        m_texcoord_transform[c] = texcoord_min[c];
+        m_texcoord_transform[2 + c] = texcoord_max[c] > texcoord_min[c] ? texcoord_max[c] - texcoord_min[c] : 1.0f;
     }
 
-    if (0 < m_texcoord_buffer && -1 !=texcoord_location)
+    for (size_t i = 0; i < m_positions.size(); ++i, out += stride)
     {
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, m_texcoord_buffer);
-        glVertexAttribPointer(texcoord_location, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+        const float coords[3] = {m_positions[i].x, m_positions[i].y, m_positions[i].z};
+        uint16_t position[4] = {0, 0, 0, 0}; // padded to keep the following attributes aligned
+        for (int c = 0; c < 3; ++c)
+            position[c] = quantizeUnorm16((coords[c] - m_position_offset[c]) / m_position_scale[c]);
+        std::memcpy(out, position, sizeof(position));
+
+        if (has_normals)
+        {
+            const uint32_t normal = packSnorm10(m_normals[i].x) | packSnorm10(m_normals[i].y) << 10
+                                    | packSnorm10(m_normals[i].z) << 20;
+            std::memcpy(out + normal_offset, &normal, sizeof(normal));
+        }
+        if (has_texcoords)
+        {
+            const uint16_t texcoord[2] = {
+                quantizeUnorm16((m_texcoords[i].first - m_texcoord_transform[0]) / m_texcoord_transform[2]),
+                quantizeUnorm16((m_texcoords[i].second - m_texcoord_transform[1]) / m_texcoord_transform[3])};
+            std::memcpy(out + texcoord_offset, texcoord, sizeof(texcoord));
+        }
     }
 }
 
-void Mesh::unbindBuffers()
+void Mesh::bind(GlState& state)
 {
-    glEnableVertexAttribArray(0);
-    if (0 < m_normal_buffer)
-        glEnableVertexAttribArray(1);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    state.bindVertexArray(m_vao);
 }
 
 void Mesh::addFace(const std::array<uint32_t, 3>&& indices)
 {
     m_indices.emplace_back(indices);
+    m_bvh.reset();
 }
 
 void Mesh::addVertexPosition(float x, float y, float z)
 {
+    m_bounds_valid = false;
+    m_bvh.reset();
     m_positions.emplace_back(x, y, z);
 }
 
 void Mesh::addVertexPositions(const std::vector<Vec3D>& positions)
 {
+    m_bounds_valid = false;
+    m_bvh.reset();
     m_positions.insert(m_positions.begin(), positions.begin(), positions.end());
 }
 
@@ -110,6 +393,8 @@ void Mesh::addVertexTexCoords(const std::vector<std::pair<float, float>>& coords
 
 uint32_t Mesh::addVertex(const Vec3D& vertex, const Vec3D& normal)
 {
+    m_bounds_valid = false;
+    m_bvh.reset();
     const auto idx = static_cast<uint32_t>(m_positions.size());
     m_positions.emplace_back(vertex);
     m_normals.emplace_back(normal);
@@ -118,56 +403,165 @@ uint32_t Mesh::addVertex(const Vec3D& vertex, const Vec3D& normal)
 
 uint32_t Mesh::addNormalizedVertex(const Vec3D&& vertex)
 {
+    m_bounds_valid = false;
+    m_bvh.reset();
     const auto idx = static_cast<uint32_t>(m_positions.size());
     m_positions.emplace_back(vertex);
     m_positions.back().normalize();
     return idx;
 }
 
-void Mesh::draw()
+const BoundingBox& Mesh::getBoundingBox() const
+{
+    updateBounds();
+    return m_bounding_box;
+}
+
+const BoundingSphere& Mesh::getBoundingSphere() const
 {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
-    glDrawElements(GL_TRIANGLES, 3 * (GLsizei)m_indices.size(), GL_UNSIGNED_INT, nullptr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    updateBounds();
+    return m_bounding_sphere;
+}
+
+void Mesh::updateBounds() const
+{
+    if (m_bounds_valid)
+        return;
+    m_bounding_box = BoundingBox::fromPositions(m_positions);
+    m_bounding_sphere = BoundingSphere::fromPositions(m_positions, m_bounding_box);
+    m_bounds_valid = true;
+}
+
+void Mesh::buildBvh()
+{
+    if (!m_bvh)
+        m_bvh = std::make_unique<MeshBvh>(m_indices, m_positions);
+}
+
+void Mesh::setInstanceBuffer(GLuint buffer, GLintptr offset)
+{
+    glVertexArrayVertexBuffer(m_vao, INSTANCE_BINDING, buffer, offset, 16 * sizeof(GLfloat));
+}
+
+void Mesh::draw(size_t lod, GLsizei instance_count, GLuint base_instance)
+{
+    if (m_indices.empty())
+        return;
+
+    for (const DrawRange& range: m_draw_ranges[std::min(lod, m_draw_ranges.size() - 1)])
+    {
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, range.count, m_index_type,
+                                                      reinterpret_cast<const void*>(range.offset), instance_count,
+                                                      range.base_vertex, base_instance);
+    }
+}
+
+void Mesh::optimize(MeshOptimizer::VertexCacheStatistics* before, MeshOptimizer::VertexCacheStatistics* after)
+{
+    if (before)
+        *before += MeshOptimizer::analyzeVertexCache(m_indices, m_positions.size());
+
+    MeshOptimizer::optimizeVertexCache(m_indices, m_positions.size());
+    MeshOptimizer::optimizeOverdraw(m_indices, m_positions);
+
+    const std::vector<uint32_t> remap = MeshOptimizer::optimizeVertexFetch(m_indices, m_positions.size());
+    const size_t vertex_count = remap.size() - static_cast<size_t>(std::count(remap.begin(), remap.end(), UINT32_MAX));
+    remapVertices(m_positions, remap, vertex_count);
+    remapVertices(m_normals, remap, vertex_count);
+    remapVertices(m_texcoords, remap, vertex_count);
+    m_bounds_valid = false; // unreferenced vertices are dropped
+    m_bvh.reset();
+
+    if (after)
+        *after += MeshOptimizer::analyzeVertexCache(m_indices, m_positions.size());
+}
+
+void Mesh::generateLods()
+{
+    m_lods.clear();
+    if (m_indices.size() < 2 * MIN_LOD_FACES)
+        return;
+
+    // exact duplicates, e.g. vertices an OBJ file repeats, would look like seams to the simplifier and
+    // lock it in place, so it sees them welded
+    std::vector<uint32_t> order(m_positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    const bool has_normals = hasNormals();
+    const bool has_texcoords = hasTexCoords();
+    const auto attributes = [&](uint32_t v) {
+        const Vec3D& p = m_positions[v];
+        const Vec3D n = has_normals ? m_normals[v] : Vec3D{0.0f, 0.0f, 0.0f};
+        const std::pair<float, float> t = has_texcoords ? m_texcoords[v] : std::make_pair(0.0f, 0.0f);
+        return std::make_tuple(p.x, p.y, p.z, n.x, n.y, n.z, t.first, t.second);
+    };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return attributes(a) < attributes(b); });
+
+    std::vector<uint32_t> canonical(m_positions.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const bool duplicate = 0 < i && attributes(order[i]) == attributes(order[i - 1]);
+        canonical[order[i]] = duplicate ? canonical[order[i - 1]] : order[i];
+    }
+
+    std::vector<std::array<uint32_t, 3>> welded(m_indices.size());
+    for (size_t f = 0; f < m_indices.size(); ++f)
+        welded[f] = {{canonical[m_indices[f][0]], canonical[m_indices[f][1]], canonical[m_indices[f][2]]}};
+
+    const float max_error = LOD_MAX_ERROR * 0.5f * getBoundingBox().extent().length();
+
+    // later levels continue from the previous one, so the error keeps accumulating in the quadrics
+    MeshSimplifier simplifier(welded, m_positions);
+    size_t previous_count = m_indices.size();
+    for (float ratio: LOD_RATIOS)
+    {
+        const auto target = static_cast<size_t>(ratio * static_cast<float>(m_indices.size()));
+        if (target < MIN_LOD_FACES)
+            break;
+
+        simplifier.simplify(target, max_error);
+        if (static_cast<float>(simplifier.faces().size()) > MIN_LOD_REDUCTION * static_cast<float>(previous_count))
+            break;
+
+        Lod lod{simplifier.faces(), simplifier.error()};
+        MeshOptimizer::optimizeVertexCache(lod.faces, m_positions.size());
+        previous_count = lod.faces.size();
+        m_lods.push_back(std::move(lod));
+    }
+}
+
+void Mesh::setPositions(std::vector<Vec3D>&& positions)
+{
+    m_positions = std::move(positions);
+    m_bounds_valid = false;
+    m_bvh.reset();
+}
+
+void Mesh::setIndices(std::vector<std::array<uint32_t, 3>>&& indices)
+{
+    m_indices = std::move(indices);
+    m_lods.clear();
+    m_bvh.reset();
 }
 
 void Mesh::scale(float factor)
 {
+    m_bounds_valid = false;
+    m_bvh.reset();
     for (auto& vtx : m_positions)
     {
         vtx *= factor;
     }
 }
 
-void Mesh::subDivide(uint_fast8_t level)
+void Mesh::subDivide(uint_fast8_t level, MeshSubdivider::Scheme scheme)
 {
     assert(level > 0);
 
     for (int i = 0; i < level; ++i)
-    {
-        std::vector<std::array<uint32_t, 3>> new_faces;
-
-        for (const auto& face : m_indices)
-        {
-            const auto v1 = m_positions[face[0]];
-            const auto v2 = m_positions[face[1]];
-            const auto v3 = m_positions[face[2]];
-
-            Vec3D v1_v2{(v1 + v2) / 2.0f}; v1_v2.normalize();
-            const auto v1_v2_idx = addVertex(v1_v2, v1_v2);
-            Vec3D v2_v3{(v2 + v3) / 2.0f}; v2_v3.normalize();
-            const auto v2_v3_idx = addVertex(v2_v3, v2_v3);
-            Vec3D v3_v1{(v3 + v1) / 2.0f}; v3_v1.normalize();
-            const auto v3_v1_idx = addVertex(v3_v1, v3_v1);
-
-            new_faces.push_back({face[0], v1_v2_idx, v3_v1_idx});
-            new_faces.push_back({v1_v2_idx, face[1], v2_v3_idx});
-            new_faces.push_back({v3_v1_idx, v2_v3_idx, face[2]});
-            new_faces.push_back({v1_v2_idx, v2_v3_idx, v3_v1_idx});
-        }
-
-        m_indices = new_faces;
-    }
+        MeshSubdivider::subdivide(m_indices, m_positions, m_normals, m_texcoords, scheme);
+    m_lods.clear();
+    m_bounds_valid = false;
+    m_bvh.reset();
 }
 
 std::unique_ptr<Mesh> Mesh::createSubDivSphere(float size, int level)
@@ -226,8 +620,10 @@ std::unique_ptr<Mesh> Mesh::createSubDivSphere(float size, int level)
     sphere->addFace({8, 6, 7});
     sphere->addFace({9, 8, 1});
 
-    sphere->subDivide(level);
+    sphere->subDivide(level, MeshSubdivider::Scheme::Sphere);
     sphere->scale(size);
+    sphere->optimize();
+    sphere->generateLods();
 
     return sphere;
 }
@@ -8,18 +8,33 @@
 #include <string>
 #include <vector>
 
+#include "bounds.h"
+#include "mesh_bvh.h"
+#include "mesh_optimizer.h"
+#include "mesh_subdivider.h"
+
+class GlState;
 struct Vec3D;
 
 
 class Mesh : protected QOpenGLFunctions_4_5_Core
 {
 public:
+    /// Coarser version of the mesh that indexes the same vertices.
+    struct Lod
+    {
+        std::vector<std::array<uint32_t, 3>> faces;
+        float error; ///< largest deviation from the full mesh, in model space
+    };
+
     explicit Mesh();
+    ~Mesh(); ///< releases the GL objects if a context is current
 
-    void initVBOs();
+    void initVBOs(); ///< no-op if already initialized
 
-    void bindBuffers(const int position_location, const int normal_location, const int texcoord_location);
-    void unbindBuffers();
+    void bind(GlState& state);
+    /// Triangle hierarchy for ray queries over the full detail faces, no-op if it is still valid.
+    void buildBvh();
 
     void addFace(const std::array<uint32_t, 3>&& indices);
     void addVertexPosition(float x, float y, float z);
@@ -29,28 +44,93 @@ public:
     void addVertexTexCoords(const std::vector<std::pair<float, float>>& coords);
     uint32_t addVertex(const Vec3D& vertex, const Vec3D& normal);
     uint32_t addNormalizedVertex(const Vec3D&& vertex);
-    void draw();
+    /// Instances start at the base_instance-th matrix of the instance buffer.
+    void draw(size_t lod, GLsizei instance_count, GLuint base_instance = 0);
+    /// Builds up to three coarser levels of detail, call it after optimize().
+    void generateLods();
+    /// Bounds of the positions in model space, computed on first use after the positions changed.
+    const BoundingBox& getBoundingBox() const;
+    const BoundingSphere& getBoundingSphere() const;
+    const MeshBvh* getBvh() const { return m_bvh.get(); } ///< nullptr until buildBvh() or after a change
+    size_t getGpuMemory() const { return m_gpu_memory; }
+    size_t getUncompressedGpuMemory() const { return m_uncompressed_gpu_memory; } ///< with float attributes
+    const std::array<float, 3>& getPositionOffset() const { return m_position_offset; }
+    const std::array<float, 3>& getPositionScale() const { return m_position_scale; }
+    const std::array<float, 4>& getTexCoordTransform() const { return m_texcoord_transform; } ///< offset xy, scale zw
     uint32_t getFaceCount() const { return m_indices.size(); }
+    const std::vector<std::array<uint32_t, 3>>& getIndices() const { return m_indices; }
+    size_t getLodCount() const { return 1 + m_lods.size(); }
+    float getLodError(size_t lod) const { return 0 == lod ? 0.0f : m_lods[lod - 1].error; }
+    const std::vector<Lod>& getLods() const { return m_lods; }
     std::string getMaterial() const { return m_material; }
+    const std::vector<Vec3D>& getNormals() const { return m_normals; }
+    const std::vector<Vec3D>& getPositions() const { return m_positions; }
+    const std::vector<std::pair<float, float>>& getTexCoords() const { return m_texcoords; }
     uint32_t getVertexCount() const { return m_positions.size(); }
+    /// The material's dissolve is below 1, objects using the mesh are drawn in the transparent pass.
+    bool isTranslucent() const { return m_translucent; }
+    /// Reorders triangles for vertex cache reuse and overdraw, then vertices by first use.
+    void optimize(MeshOptimizer::VertexCacheStatistics* before = nullptr,
+                  MeshOptimizer::VertexCacheStatistics* after = nullptr);
     void scale(float factor);
+    void setIndices(std::vector<std::array<uint32_t, 3>>&& indices);
+    /// Per-instance model matrices for draw(), 16 floats each starting at offset.
+    void setInstanceBuffer(GLuint buffer, GLintptr offset);
+    void setLods(std::vector<Lod>&& lods) { m_lods = std::move(lods); }
     void setMaterial(const std::string& material) { m_material = material; }
-    void subDivide(uint_fast8_t level);
+    void setNormals(std::vector<Vec3D>&& normals) { m_normals = std::move(normals); }
+    void setPositions(std::vector<Vec3D>&& positions);
+    void setTexCoords(std::vector<std::pair<float, float>>&& coords) { m_texcoords = std::move(coords); }
+    void setTranslucent(bool translucent) { m_translucent = translucent; }
+    void setVertexQuantization(bool enabled) { m_quantize_vertices = enabled; } ///< before initVBOs()
+    void subDivide(uint_fast8_t level, MeshSubdivider::Scheme scheme);
 
     static std::unique_ptr<Mesh> createSubDivSphere(float size, int level);
 
 private:
+    struct DrawRange
+    {
+        GLsizei count;
+        size_t offset; ///< in bytes
+        GLint base_vertex;
+    };
+
+    /// Attributes only count if every position has one, OBJ faces may give them to some corners only.
+    bool hasNormals() const { return !m_normals.empty() && m_normals.size() == m_positions.size(); }
+    bool hasTexCoords() const { return !m_texcoords.empty() && m_texcoords.size() == m_positions.size(); }
+    void updateBounds() const;
+    void writeFloatVertices(uchar* out, size_t stride, size_t normal_offset, size_t texcoord_offset) const;
+    void writeQuantizedVertices(uchar* out, size_t stride, size_t normal_offset, size_t texcoord_offset);
+
+private:
+    GLuint m_vao;           ///< vertex format and buffer bindings of this mesh
+    GLuint m_vertex_buffer; ///< interleaved position, normal and texcoord
+
     GLuint m_index_buffer;                          ///< gl id for vbo indices
+    GLenum m_index_type;                            ///< GL_UNSIGNED_SHORT whenever the draw ranges allow it
+    std::vector<std::vector<DrawRange>> m_draw_ranges; ///< per level of detail
     std::vector<std::array<uint32_t, 3>> m_indices; ///< vbo indices
+    std::vector<Lod> m_lods;                        ///< stored after m_indices in the index buffer
 
     std::string m_material;
+    bool m_translucent{false};
 
-    GLuint m_normal_buffer;
     std::vector<Vec3D> m_normals;
-
-    GLuint m_position_buffer;       ///< gl id for vbo vertices
     std::vector<Vec3D> m_positions; ///< vbo vertex positions
-
-    GLuint m_texcoord_buffer;
     std::vector<std::pair<float, float>> m_texcoords;
+
+    // caches of m_positions, reset by everything that changes them
+    mutable BoundingBox m_bounding_box;
+    mutable BoundingSphere m_bounding_sphere;
+    mutable bool m_bounds_valid{false};
+    std::unique_ptr<MeshBvh> m_bvh; ///< references m_indices and m_positions
+
+    /// the GPU copy stores positions and texcoords relative to their bounds
+    bool m_quantize_vertices{true};
+    std::array<float, 3> m_position_offset{{0.0f, 0.0f, 0.0f}};
+    std::array<float, 3> m_position_scale{{1.0f, 1.0f, 1.0f}};
+    std::array<float, 4> m_texcoord_transform{{0.0f, 0.0f, 1.0f, 1.0f}};
+
+    size_t m_gpu_memory{0};
+    size_t m_uncompressed_gpu_memory{0};
 };
@@ -0,0 +1,510 @@
+#include "mesh_bvh.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+
+namespace
+{
+    const uint32_t MAX_LEAF_SIZE = 4;     ///< always a leaf at or below
+    const uint32_t MAX_SAH_LEAF_SIZE = 8; ///< a leaf if splitting doesn't pay off, up to this many triangles
+    const uint32_t MAX_DEPTH = 64;        ///< size of the traversal stacks, deeper nodes become leaves
+    const size_t BIN_COUNT = 16;
+    const float TRAVERSAL_COST = 1.0f;    ///< relative to one triangle test
+    const uint32_t MIN_TASK_SIZE = 1 << 12; ///< smaller subtrees are built by the thread that found them
+    const size_t TASKS_PER_THREAD = 4;    ///< evens out subtrees of different cost
+    const float MIN_DIRECTION = 1e-20f;   ///< smallest ray direction component in the slab test
+
+    using Vec3 = std::array<float, 3>;
+
+    struct Aabb
+    {
+        Vec3 min{{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                  std::numeric_limits<float>::max()}};
+        Vec3 max{{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                  std::numeric_limits<float>::lowest()}};
+
+        void extend(const Aabb& other)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                min[axis] = std::min(min[axis], other.min[axis]);
+                max[axis] = std::max(max[axis], other.max[axis]);
+            }
+        }
+
+        void extend(const Vec3& point)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                min[axis] = std::min(min[axis], point[axis]);
+                max[axis] = std::max(max[axis], point[axis]);
+            }
+        }
+
+        float area() const
+        {
+            const float x = max[0] - min[0];
+            const float y = max[1] - min[1];
+            const float z = max[2] - min[2];
+            return x < 0.0f ? 0.0f : 2.0f * (x * y + y * z + z * x);
+        }
+    };
+
+    Vec3 toVec3(const Vec3D& v)
+    {
+        return {{v.x, v.y, v.z}};
+    }
+
+    Vec3 sub(const Vec3& a, const Vec3& b)
+    {
+        return {{a[0] - b[0], a[1] - b[1], a[2] - b[2]}};
+    }
+
+    Vec3 cross(const Vec3& a, const Vec3& b)
+    {
+        return {{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]}};
+    }
+
+    float dot(const Vec3& a, const Vec3& b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    /// Inverse direction for the slab test. A zero component would give 0 * inf = NaN for planes
+    /// through the origin, so it is replaced by a tiny one, which still lets the axis pass or fail as a whole.
+    Vec3 inverse(const Vec3& direction)
+    {
+        Vec3 result;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float d = direction[axis];
+            result[axis] = 1.0f / (std::abs(d) < MIN_DIRECTION ? std::copysign(MIN_DIRECTION, d) : d);
+        }
+        return result;
+    }
+
+#if defined(__AVX__)
+    const size_t LANES = 8;
+    using Lanes = __m256;
+    Lanes broadcast(float x) { return _mm256_set1_ps(x); }
+    Lanes load(const float* p) { return _mm256_loadu_ps(p); }
+    Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+    Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+    Lanes minimum(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+    Lanes maximum(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+    int lessEqualMask(Lanes a, Lanes b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+#elif defined(__SSE__) || defined(_M_X64)
+    const size_t LANES = 4;
+    using Lanes = __m128;
+    Lanes broadcast(float x) { return _mm_set1_ps(x); }
+    Lanes load(const float* p) { return _mm_loadu_ps(p); }
+    Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+    Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+    Lanes minimum(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+    Lanes maximum(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+    int lessEqualMask(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+#else
+    const size_t LANES = 1;
+#endif
+}
+
+
+const size_t MeshBvh::PACKET_SIZE = LANES;
+
+struct MeshBvh::BuildData
+{
+    std::vector<Aabb> bounds; ///< per face
+    std::vector<Vec3> centroids;
+};
+
+
+MeshBvh::MeshBvh(const std::vector<Face>& faces, const std::vector<Vec3D>& positions)
+    : m_faces(faces)
+    , m_positions(positions)
+{
+    static_assert(sizeof(Node) == 32, "two nodes per cache line");
+
+    const auto face_count = static_cast<uint32_t>(faces.size());
+    if (0 == face_count)
+        return;
+
+    BuildData data;
+    data.bounds.resize(face_count);
+    data.centroids.resize(face_count);
+    m_triangles.resize(face_count);
+    for (uint32_t f = 0; f < face_count; ++f)
+    {
+        Aabb& bounds = data.bounds[f];
+        for (uint32_t v: faces[f])
+            bounds.extend(toVec3(positions[v]));
+        for (int axis = 0; axis < 3; ++axis)
+            data.centroids[f][axis] = (bounds.min[axis] + bounds.max[axis]) / 2.0f;
+        m_triangles[f] = f;
+    }
+
+    // split the upper levels here until there are enough independent subtrees for the threads
+    m_nodes.push_back({{0.0f, 0.0f, 0.0f}, 0, {0.0f, 0.0f, 0.0f}, face_count});
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    const size_t task_target = 1 < thread_count ? TASKS_PER_THREAD * thread_count : 1;
+    std::deque<std::pair<uint32_t, uint32_t>> open = {{0, 0}};
+    std::vector<std::pair<uint32_t, uint32_t>> tasks;
+    while (!open.empty() && open.size() + tasks.size() < task_target)
+    {
+        const std::pair<uint32_t, uint32_t> node = open.front();
+        open.pop_front();
+        if (m_nodes[node.first].count < MIN_TASK_SIZE)
+        {
+            tasks.push_back(node);
+        }
+        else if (splitNode(data, m_triangles, m_nodes, node.first, node.second))
+        {
+            open.push_back({m_nodes[node.first].first, node.second + 1});
+            open.push_back({m_nodes[node.first].first + 1, node.second + 1});
+        }
+    }
+    tasks.insert(tasks.end(), open.begin(), open.end());
+
+    // every subtree is built into its own array with its root at index 0, the triangle ranges are disjoint
+    std::vector<std::vector<Node>> subtrees(tasks.size());
+    std::atomic<size_t> next_task{0};
+    const auto work = [&]() {
+        for (size_t t = next_task++; t < tasks.size(); t = next_task++)
+        {
+            subtrees[t] = {m_nodes[tasks[t].first]};
+            buildSubtree(data, m_triangles, subtrees[t], 0, tasks[t].second);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(thread_count, tasks.size()); ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker: workers)
+        worker.join();
+
+    for (size_t t = 0; t < tasks.size(); ++t)
+    {
+        const std::vector<Node>& subtree = subtrees[t];
+        const auto offset = static_cast<uint32_t>(m_nodes.size()) - 1;
+        const auto relocated = [offset](Node node) {
+            if (0 == node.count)
+                node.first += offset;
+            return node;
+        };
+        m_nodes[tasks[t].first] = relocated(subtree[0]);
+        for (size_t i = 1; i < subtree.size(); ++i)
+            m_nodes.push_back(relocated(subtree[i]));
+    }
+}
+
+bool MeshBvh::splitNode(const BuildData& data, std::vector<uint32_t>& triangles, std::vector<Node>& nodes,
+                        uint32_t index, uint32_t depth)
+{
+    const uint32_t first = nodes[index].first;
+    const uint32_t count = nodes[index].count;
+
+    Aabb bounds;
+    Aabb centroid_bounds;
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        bounds.extend(data.bounds[triangles[i]]);
+        centroid_bounds.extend(data.centroids[triangles[i]]);
+    }
+    std::copy(bounds.min.begin(), bounds.min.end(), nodes[index].min);
+    std::copy(bounds.max.begin(), bounds.max.end(), nodes[index].max);
+    if (count <= MAX_LEAF_SIZE || depth + 1 >= MAX_DEPTH)
+        return false;
+
+    int axis = 0;
+    for (int a = 1; a < 3; ++a)
+    {
+        if (centroid_bounds.max[a] - centroid_bounds.min[a] > centroid_bounds.max[axis] - centroid_bounds.min[axis])
+            axis = a;
+    }
+    const float spread = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+
+    uint32_t middle = first + count / 2;
+    if (0.0f < spread)
+    {
+        const float bin_scale = BIN_COUNT / spread * (1.0f - 1e-5f);
+        const float bin_origin = centroid_bounds.min[axis];
+        const auto binOf = [&](uint32_t face) {
+            return std::min(static_cast<size_t>((data.centroids[face][axis] - bin_origin) * bin_scale), BIN_COUNT - 1);
+        };
+
+        Aabb bin_bounds[BIN_COUNT];
+        uint32_t bin_counts[BIN_COUNT] = {};
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const size_t bin = binOf(triangles[i]);
+            bin_bounds[bin].extend(data.bounds[triangles[i]]);
+            ++bin_counts[bin];
+        }
+
+        float right_costs[BIN_COUNT];
+        Aabb right;
+        uint32_t right_count = 0;
+        for (size_t bin = BIN_COUNT - 1; bin > 0; --bin)
+        {
+            right.extend(bin_bounds[bin]);
+            right_count += bin_counts[bin];
+            right_costs[bin] = right_count * right.area();
+        }
+        float best_cost = std::numeric_limits<float>::max();
+        size_t best_split = 0;
+        Aabb left;
+        uint32_t left_count = 0;
+        for (size_t split = 1; split < BIN_COUNT; ++split)
+        {
+            left.extend(bin_bounds[split - 1]);
+            left_count += bin_counts[split - 1];
+            const float cost = left_count * left.area() + right_costs[split];
+            if (0 < left_count && left_count < count && cost < best_cost)
+            {
+                best_cost = cost;
+                best_split = split;
+            }
+        }
+
+        const float area = bounds.area();
+        const float split_cost = 0.0f < area ? TRAVERSAL_COST + best_cost / area : 0.0f;
+        if (count <= MAX_SAH_LEAF_SIZE && count <= split_cost)
+            return false;
+        if (0 != best_split)
+        {
+            const auto split_end = std::partition(triangles.begin() + first, triangles.begin() + first + count,
+                                                  [&](uint32_t face) { return binOf(face) < best_split; });
+            middle = static_cast<uint32_t>(split_end - triangles.begin());
+        }
+    }
+    else if (count <= MAX_SAH_LEAF_SIZE)
+    {
+        return false;
+    }
+
+    const auto left_index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({{0.0f, 0.0f, 0.0f}, first, {0.0f, 0.0f, 0.0f}, middle - first});
+    nodes.push_back({{0.0f, 0.0f, 0.0f}, middle, {0.0f, 0.0f, 0.0f}, first + count - middle});
+    nodes[index].first = left_index;
+    nodes[index].count = 0;
+    return true;
+}
+
+void MeshBvh::buildSubtree(const BuildData& data, std::vector<uint32_t>& triangles, std::vector<Node>& nodes,
+                           uint32_t root, uint32_t depth)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{root, depth}};
+    while (!stack.empty())
+    {
+        const std::pair<uint32_t, uint32_t> node = stack.back();
+        stack.pop_back();
+        if (splitNode(data, triangles, nodes, node.first, node.second))
+        {
+            stack.push_back({nodes[node.first].first + 1, node.second + 1});
+            stack.push_back({nodes[node.first].first, node.second + 1});
+        }
+    }
+}
+
+size_t MeshBvh::getMemory() const
+{
+    return m_nodes.capacity() * sizeof(Node) + m_triangles.capacity() * sizeof(uint32_t);
+}
+
+void MeshBvh::intersectTriangle(uint32_t position, const Ray& ray, Hit& hit) const
+{
+    // Moeller and Trumbore
+    const uint32_t face = m_triangles[position];
+    const Vec3 p0 = toVec3(m_positions[m_faces[face][0]]);
+    const Vec3 e1 = sub(toVec3(m_positions[m_faces[face][1]]), p0);
+    const Vec3 e2 = sub(toVec3(m_positions[m_faces[face][2]]), p0);
+
+    const Vec3 p = cross(ray.direction, e2);
+    const float determinant = dot(e1, p);
+    if (0.0f == determinant)
+        return;
+    const float inverse_determinant = 1.0f / determinant;
+
+    const Vec3 s = sub(ray.origin, p0);
+    const float u = dot(s, p) * inverse_determinant;
+    if (u < 0.0f || u > 1.0f)
+        return;
+    const Vec3 q = cross(s, e1);
+    const float v = dot(ray.direction, q) * inverse_determinant;
+    if (v < 0.0f || u + v > 1.0f)
+        return;
+    const float t = dot(e2, q) * inverse_determinant;
+    if (t < 0.0f || t > hit.t)
+        return;
+
+    hit = {face, t, u, v};
+}
+
+MeshBvh::Hit MeshBvh::intersect(const Ray& ray) const
+{
+    Hit hit;
+    hit.t = ray.max_t;
+    if (m_nodes.empty())
+        return hit;
+
+    const Vec3 inverse_direction = inverse(ray.direction);
+    // entry distance of the node or infinity if the ray misses it before hit.t
+    const auto enter = [&](const Node& node) {
+        float t_min = 0.0f;
+        float t_max = hit.t;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float t0 = (node.min[axis] - ray.origin[axis]) * inverse_direction[axis];
+            const float t1 = (node.max[axis] - ray.origin[axis]) * inverse_direction[axis];
+            t_min = std::max(t_min, std::min(t0, t1));
+            t_max = std::min(t_max, std::max(t0, t1));
+        }
+        return t_min <= t_max ? t_min : std::numeric_limits<float>::infinity();
+    };
+
+    std::pair<uint32_t, float> stack[MAX_DEPTH];
+    size_t stack_size = 0;
+    if (enter(m_nodes[0]) <= hit.t)
+        stack[stack_size++] = {0, 0.0f};
+
+    while (0 < stack_size)
+    {
+        const std::pair<uint32_t, float> entry = stack[--stack_size];
+        if (entry.second > hit.t)
+            continue;
+
+        // follow the nearer child directly and come back for the farther one
+        uint32_t index = entry.first;
+        while (0 == m_nodes[index].count)
+        {
+            const uint32_t left = m_nodes[index].first;
+            const float t_left = enter(m_nodes[left]);
+            const float t_right = enter(m_nodes[left + 1]);
+            if (t_left <= t_right)
+            {
+                if (std::isinf(t_left))
+                    break;
+                if (!std::isinf(t_right))
+                    stack[stack_size++] = {left + 1, t_right};
+                index = left;
+            }
+            else
+            {
+                if (!std::isinf(t_left))
+                    stack[stack_size++] = {left, t_left};
+                index = left + 1;
+            }
+        }
+
+        const Node& node = m_nodes[index];
+        for (uint32_t position = node.first; position < node.first + node.count; ++position)
+            intersectTriangle(position, ray, hit);
+    }
+
+    return hit;
+}
+
+void MeshBvh::intersect(const Ray* rays, Hit* hits, size_t count) const
+{
+    for (size_t i = 0; i < count; i += PACKET_SIZE)
+        intersectPacket(rays + i, hits + i, std::min(PACKET_SIZE, count - i));
+}
+
+void MeshBvh::intersectPacket(const Ray* rays, Hit* hits, size_t count) const
+{
+#if defined(__AVX__) || defined(__SSE__) || defined(_M_X64)
+    for (size_t k = 0; k < count; ++k)
+    {
+        hits[k] = Hit();
+        hits[k].t = rays[k].max_t;
+    }
+    if (m_nodes.empty())
+        return;
+
+    // unused lanes get a negative t and never enter a node
+    float origin[3][LANES] = {};
+    float inverse_direction[3][LANES] = {};
+    float t[LANES];
+    for (size_t k = 0; k < LANES; ++k)
+    {
+        const Vec3 inverse_k = inverse(rays[std::min(k, count - 1)].direction);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            origin[axis][k] = rays[std::min(k, count - 1)].origin[axis];
+            inverse_direction[axis][k] = inverse_k[axis];
+        }
+        t[k] = k < count ? rays[k].max_t : -1.0f;
+    }
+    const Lanes origin_x = load(origin[0]);
+    const Lanes origin_y = load(origin[1]);
+    const Lanes origin_z = load(origin[2]);
+    const Lanes inverse_x = load(inverse_direction[0]);
+    const Lanes inverse_y = load(inverse_direction[1]);
+    const Lanes inverse_z = load(inverse_direction[2]);
+    const Lanes zero = broadcast(0.0f);
+
+    // lanes that enter the node before their closest hit so far
+    const auto enter = [&](const Node& node) {
+        const Lanes tx0 = mul(sub(broadcast(node.min[0]), origin_x), inverse_x);
+        const Lanes tx1 = mul(sub(broadcast(node.max[0]), origin_x), inverse_x);
+        const Lanes ty0 = mul(sub(broadcast(node.min[1]), origin_y), inverse_y);
+        const Lanes ty1 = mul(sub(broadcast(node.max[1]), origin_y), inverse_y);
+        const Lanes tz0 = mul(sub(broadcast(node.min[2]), origin_z), inverse_z);
+        const Lanes tz1 = mul(sub(broadcast(node.max[2]), origin_z), inverse_z);
+        const Lanes t_min = maximum(maximum(zero, minimum(tx0, tx1)),
+                                    maximum(minimum(ty0, ty1), minimum(tz0, tz1)));
+        const Lanes t_max = minimum(minimum(load(t), maximum(tx0, tx1)), minimum(maximum(ty0, ty1), maximum(tz0, tz1)));
+        return lessEqualMask(t_min, t_max);
+    };
+
+    // children are visited in the order of the first ray, coherent rays mostly agree with it
+    const Vec3& direction = rays[0].direction;
+    uint32_t stack[MAX_DEPTH];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+    while (0 < stack_size)
+    {
+        const Node& node = m_nodes[stack[--stack_size]];
+        const int active = enter(node);
+        if (0 == active)
+            continue;
+
+        if (0 == node.count)
+        {
+            const Node& left = m_nodes[node.first];
+            const Node& right = m_nodes[node.first + 1];
+            float toward_right = 0.0f;
+            for (int axis = 0; axis < 3; ++axis)
+                toward_right += direction[axis] * (right.min[axis] + right.max[axis] - left.min[axis] - left.max[axis]);
+            stack[stack_size++] = 0.0f <= toward_right ? node.first + 1 : node.first;
+            stack[stack_size++] = 0.0f <= toward_right ? node.first : node.first + 1;
+            continue;
+        }
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (!(active & (1 << k)))
+                continue;
+            for (uint32_t position = node.first; position < node.first + node.count; ++position)
+                intersectTriangle(position, rays[k], hits[k]);
+            t[k] = hits[k].t;
+        }
+    }
+#else
+    for (size_t k = 0; k < count; ++k)
+        hits[k] = intersect(rays[k]);
+#endif
+}
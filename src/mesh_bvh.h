@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+struct Vec3D;
+
+
+/// Bounding volume hierarchy over the triangles of a mesh, for ray queries like picking.
+///
+/// Built top down with a binned surface area heuristic, the upper levels on the calling thread and
+/// the subtrees below them in parallel. Nodes take 32 bytes, two per cache line, and siblings are
+/// stored next to each other. The hierarchy references the faces and positions it was built from,
+/// they have to stay unchanged while it is in use.
+class MeshBvh
+{
+public:
+    using Face = MeshOptimizer::Face;
+
+    static const uint32_t INVALID_FACE = UINT32_MAX;
+    /// Rays traversed together by the packet intersect(): 8 with AVX, 4 with SSE, 1 otherwise.
+    static const size_t PACKET_SIZE;
+
+    struct Ray
+    {
+        std::array<float, 3> origin;
+        std::array<float, 3> direction; ///< need not be normalized, t is measured in multiples of it
+        float max_t;
+    };
+
+    struct Hit
+    {
+        uint32_t face{INVALID_FACE}; ///< INVALID_FACE on a miss
+        float t{0.0f};
+        float u{0.0f}; ///< barycentric weight of the face's second vertex
+        float v{0.0f}; ///< barycentric weight of the face's third vertex
+    };
+
+    MeshBvh(const std::vector<Face>& faces, const std::vector<Vec3D>& positions);
+
+    /// Closest hit with t in [0, ray.max_t], triangles are hit from both sides.
+    Hit intersect(const Ray& ray) const;
+    /// The same for count rays, PACKET_SIZE at a time. Coherent rays, e.g. through neighbouring
+    /// pixels, share most of their node tests.
+    void intersect(const Ray* rays, Hit* hits, size_t count) const;
+
+    size_t getNodeCount() const { return m_nodes.size(); }
+    size_t getMemory() const; ///< in bytes
+
+private:
+    struct Node
+    {
+        float min[3];
+        uint32_t first; ///< left child of inner nodes, the right one follows it, first triangle of leaves
+        float max[3];
+        uint32_t count; ///< triangles of leaves, 0 for inner nodes
+    };
+
+    struct BuildData; ///< per triangle bounds and centroids
+
+    /// Splits the node's triangle range into two children, returns false if it stays a leaf.
+    static bool splitNode(const BuildData& data, std::vector<uint32_t>& triangles, std::vector<Node>& nodes,
+                          uint32_t index, uint32_t depth);
+    static void buildSubtree(const BuildData& data, std::vector<uint32_t>& triangles, std::vector<Node>& nodes,
+                             uint32_t root, uint32_t depth);
+
+    void intersectTriangle(uint32_t position, const Ray& ray, Hit& hit) const;
+    void intersectPacket(const Ray* rays, Hit* hits, size_t count) const; ///< up to PACKET_SIZE rays
+
+private:
+    const std::vector<Face>& m_faces;
+    const std::vector<Vec3D>& m_positions;
+    std::vector<Node> m_nodes;         ///< root first
+    std::vector<uint32_t> m_triangles; ///< faces in tree order, every leaf covers a range of them
+};
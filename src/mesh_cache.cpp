@@ -0,0 +1,284 @@
+#include "mesh_cache.h"
+
+#include "mesh.h"
+#include "util.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QString>
+
+#include <cstring>
+
+
+namespace
+{
+    const char CACHE_MAGIC[8] = {'C', 'G', 'L', 'M', 'E', 'S', 'H', '\0'};
+    /// 2: meshes are stored optimized, 3: with levels of detail, 4: with the translucency of the material,
+    /// 5: with the stamps of the material libraries
+    const uint32_t CACHE_VERSION = 5;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t mesh_count;
+        int64_t source_size;
+        int64_t source_mtime; ///< msecs since epoch
+        uint32_t material_file_count; ///< a FileHeader and the padded path follow for each
+        uint32_t padding;
+    };
+
+    /// Stamp of a material library, the size is -1 for files that don't exist.
+    struct FileHeader
+    {
+        int64_t size;
+        int64_t mtime; ///< msecs since epoch
+        uint32_t path_length;
+        uint32_t padding;
+    };
+
+    struct MeshHeader
+    {
+        uint32_t position_count;
+        uint32_t normal_count;
+        uint32_t texcoord_count;
+        uint32_t face_count;
+        uint32_t material_length; ///< material path is padded to 4 bytes in the file
+        uint32_t lod_count;       ///< LodHeader and faces follow the full mesh for each
+        uint32_t translucent;     ///< 0 or 1
+    };
+
+    struct LodHeader
+    {
+        uint32_t face_count;
+        float error;
+    };
+
+    static_assert(sizeof(Vec3D) == 3 * sizeof(float), "Vec3D must be tightly packed for the cache");
+    static_assert(sizeof(std::pair<float, float>) == 2 * sizeof(float), "texcoords must be tightly packed");
+    static_assert(sizeof(std::array<uint32_t, 3>) == 3 * sizeof(uint32_t), "faces must be tightly packed");
+
+    size_t padded(size_t size) { return (size + 3) & ~size_t{3}; }
+
+    int64_t fileSize(const QFileInfo& info) { return info.exists() ? info.size() : -1; }
+    int64_t fileMtime(const QFileInfo& info) { return info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0; }
+
+    template <typename T>
+    bool writeArray(QSaveFile& file, const std::vector<T>& data)
+    {
+        const auto bytes = static_cast<qint64>(data.size() * sizeof(T));
+        return bytes == file.write(reinterpret_cast<const char*>(data.data()), bytes);
+    }
+
+    /// Copies count elements of T out of the mapped region and advances the read pointer.
+    template <typename T>
+    std::vector<T> readArray(const uchar*& ptr, uint32_t count)
+    {
+        const T* begin = reinterpret_cast<const T*>(ptr);
+        ptr += count * sizeof(T);
+        return std::vector<T>(begin, begin + count);
+    }
+
+    /// True if all faces only reference vertices below vertex_count.
+    bool validFaces(const std::vector<std::array<uint32_t, 3>>& faces, uint32_t vertex_count)
+    {
+        for (const std::array<uint32_t, 3>& face: faces)
+        {
+            if (face[0] >= vertex_count || face[1] >= vertex_count || face[2] >= vertex_count)
+                return false;
+        }
+        return true;
+    }
+}
+
+
+QString MeshCache::cacheFileName(const QString& source_file)
+{
+    return source_file + ".meshcache";
+}
+
+std::vector<std::unique_ptr<Mesh>> MeshCache::load(const QString& source_file)
+{
+    const QFileInfo source_info(source_file);
+    QFile file(cacheFileName(source_file));
+    if (!file.open(QIODevice::ReadOnly))
+        return {};
+
+    const qint64 file_size = file.size();
+    if (file_size < static_cast<qint64>(sizeof(CacheHeader)))
+        return {};
+
+    const uchar* data = file.map(0, file_size);
+    if (!data)
+        return {};
+    const uchar* const end = data + file_size;
+
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (0 != std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) || CACHE_VERSION != header.version
+        || source_info.size() != header.source_size
+        || source_info.lastModified().toMSecsSinceEpoch() != header.source_mtime)
+    {
+        return {};
+    }
+
+    const uchar* ptr = data + sizeof(header);
+    for (uint32_t f = 0; f < header.material_file_count; ++f)
+    {
+        if (end - ptr < static_cast<ptrdiff_t>(sizeof(FileHeader)))
+            return {};
+        FileHeader file_header;
+        std::memcpy(&file_header, ptr, sizeof(file_header));
+        ptr += sizeof(file_header);
+        if (static_cast<size_t>(end - ptr) < padded(file_header.path_length))
+            return {};
+
+        const QFileInfo info(QString::fromUtf8(reinterpret_cast<const char*>(ptr),
+                                               static_cast<int>(file_header.path_length)));
+        ptr += padded(file_header.path_length);
+        if (fileSize(info) != file_header.size || fileMtime(info) != file_header.mtime)
+            return {};
+    }
+
+    // the count comes from the file, it must not reserve more meshes than the file can hold
+    if (static_cast<size_t>(end - ptr) / sizeof(MeshHeader) < header.mesh_count)
+        return {};
+    std::vector<std::unique_ptr<Mesh>> meshes;
+    meshes.reserve(header.mesh_count);
+
+    for (uint32_t m = 0; m < header.mesh_count; ++m)
+    {
+        if (end - ptr < static_cast<ptrdiff_t>(sizeof(MeshHeader)))
+            return {};
+
+        MeshHeader mesh_header;
+        std::memcpy(&mesh_header, ptr, sizeof(mesh_header));
+        ptr += sizeof(mesh_header);
+
+        // counts are widened one by one, a corrupt header must not wrap the sum
+        const size_t payload = padded(mesh_header.material_length)
+                               + size_t{mesh_header.position_count} * sizeof(Vec3D)
+                               + size_t{mesh_header.normal_count} * sizeof(Vec3D)
+                               + size_t{mesh_header.texcoord_count} * sizeof(std::pair<float, float>)
+                               + size_t{mesh_header.face_count} * sizeof(std::array<uint32_t, 3>);
+        if (static_cast<size_t>(end - ptr) < payload)
+        {
+            qDebug() << "Truncated mesh cache" << cacheFileName(source_file);
+            return {};
+        }
+
+        auto mesh = std::make_unique<Mesh>();
+        mesh->setMaterial(std::string(reinterpret_cast<const char*>(ptr), mesh_header.material_length));
+        mesh->setTranslucent(0 != mesh_header.translucent);
+        ptr += padded(mesh_header.material_length);
+
+        mesh->setPositions(readArray<Vec3D>(ptr, mesh_header.position_count));
+        mesh->setNormals(readArray<Vec3D>(ptr, mesh_header.normal_count));
+        mesh->setTexCoords(readArray<std::pair<float, float>>(ptr, mesh_header.texcoord_count));
+        std::vector<std::array<uint32_t, 3>> faces = readArray<std::array<uint32_t, 3>>(ptr, mesh_header.face_count);
+        if (!validFaces(faces, mesh_header.position_count))
+        {
+            qDebug() << "Corrupt face indices in mesh cache" << cacheFileName(source_file);
+            return {};
+        }
+        mesh->setIndices(std::move(faces));
+
+        std::vector<Mesh::Lod> lods;
+        for (uint32_t l = 0; l < mesh_header.lod_count; ++l)
+        {
+            LodHeader lod_header;
+            if (end - ptr < static_cast<ptrdiff_t>(sizeof(lod_header)))
+                return {};
+            std::memcpy(&lod_header, ptr, sizeof(lod_header));
+            ptr += sizeof(lod_header);
+
+            if (static_cast<size_t>(end - ptr) < size_t{lod_header.face_count} * sizeof(std::array<uint32_t, 3>))
+            {
+                qDebug() << "Truncated mesh cache" << cacheFileName(source_file);
+                return {};
+            }
+            std::vector<std::array<uint32_t, 3>> lod_faces
+                = readArray<std::array<uint32_t, 3>>(ptr, lod_header.face_count);
+            if (!validFaces(lod_faces, mesh_header.position_count))
+            {
+                qDebug() << "Corrupt face indices in mesh cache" << cacheFileName(source_file);
+                return {};
+            }
+            lods.push_back({std::move(lod_faces), lod_header.error});
+        }
+        mesh->setLods(std::move(lods));
+
+        meshes.push_back(std::move(mesh));
+    }
+
+    return meshes;
+}
+
+bool MeshCache::store(const QString& source_file, const std::vector<std::string>& material_files,
+                      const std::vector<std::unique_ptr<Mesh>>& meshes)
+{
+    const QFileInfo source_info(source_file);
+
+    QSaveFile file(cacheFileName(source_file));
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.mesh_count = static_cast<uint32_t>(meshes.size());
+    header.source_size = source_info.size();
+    header.source_mtime = source_info.lastModified().toMSecsSinceEpoch();
+    header.material_file_count = static_cast<uint32_t>(material_files.size());
+    header.padding = 0;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const std::string& path: material_files)
+    {
+        const QFileInfo info(QString::fromStdString(path));
+        const FileHeader file_header{fileSize(info), fileMtime(info), static_cast<uint32_t>(path.size()), 0};
+        file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+
+        std::string padded_path = path;
+        padded_path.resize(padded(path.size()), '\0');
+        file.write(padded_path.data(), static_cast<qint64>(padded_path.size()));
+    }
+
+    for (const auto& mesh: meshes)
+    {
+        const std::string material = mesh->getMaterial();
+
+        MeshHeader mesh_header;
+        mesh_header.position_count = static_cast<uint32_t>(mesh->getPositions().size());
+        mesh_header.normal_count = static_cast<uint32_t>(mesh->getNormals().size());
+        mesh_header.texcoord_count = static_cast<uint32_t>(mesh->getTexCoords().size());
+        mesh_header.face_count = static_cast<uint32_t>(mesh->getIndices().size());
+        mesh_header.material_length = static_cast<uint32_t>(material.size());
+        mesh_header.lod_count = static_cast<uint32_t>(mesh->getLods().size());
+        mesh_header.translucent = mesh->isTranslucent() ? 1 : 0;
+        file.write(reinterpret_cast<const char*>(&mesh_header), sizeof(mesh_header));
+
+        std::string padded_material = material;
+        padded_material.resize(padded(material.size()), '\0');
+        file.write(padded_material.data(), static_cast<qint64>(padded_material.size()));
+
+        if (!writeArray(file, mesh->getPositions()) || !writeArray(file, mesh->getNormals())
+            || !writeArray(file, mesh->getTexCoords()) || !writeArray(file, mesh->getIndices()))
+        {
+            return false; // QSaveFile discards the partial file
+        }
+
+        for (const Mesh::Lod& lod: mesh->getLods())
+        {
+            const LodHeader lod_header{static_cast<uint32_t>(lod.faces.size()), lod.error};
+            file.write(reinterpret_cast<const char*>(&lod_header), sizeof(lod_header));
+            if (!writeArray(file, lod.faces))
+                return false;
+        }
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+class Mesh;
+class QString;
+
+
+/// Binary cache for imported meshes, stored next to the source file.
+///
+/// The cache holds the final deduplicated vertex data of every mesh so that re-opening a model
+/// skips text parsing completely. It is invalidated whenever the size or modification time of the
+/// source file or of one of its material libraries changes, or the cache format version is bumped.
+class MeshCache
+{
+public:
+    static QString cacheFileName(const QString& source_file);
+
+    static std::vector<std::unique_ptr<Mesh>> load(const QString& source_file);
+    static bool store(const QString& source_file, const std::vector<std::string>& material_files,
+                      const std::vector<std::unique_ptr<Mesh>>& meshes);
+};
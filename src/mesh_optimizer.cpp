@@ -0,0 +1,369 @@
+#include "mesh_optimizer.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <tuple>
+
+
+namespace
+{
+    const size_t FIFO_CACHE_SIZE = 16; ///< for statistics and clustering, typical of current GPUs
+
+    // scoring parameters from Forsyth's paper
+    const int LRU_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    const uint32_t UNUSED = std::numeric_limits<uint32_t>::max();
+
+    /// FIFO post-transform cache, counts how many vertices had to be transformed.
+    class FifoCache
+    {
+    public:
+        explicit FifoCache(size_t vertex_count)
+            : m_timestamps(vertex_count, 0)
+        {
+        }
+
+        void reset() { m_time += FIFO_CACHE_SIZE + 1; } ///< everything cached so far ages out
+
+        size_t addTriangle(const MeshOptimizer::Face& face)
+        {
+            size_t misses = 0;
+            for (uint32_t v: face)
+            {
+                if (m_time - m_timestamps[v] >= FIFO_CACHE_SIZE || 0 == m_timestamps[v])
+                {
+                    m_timestamps[v] = ++m_time;
+                    ++misses;
+                }
+            }
+            return misses;
+        }
+
+    private:
+        std::vector<size_t> m_timestamps; ///< insertion time, 0 = never
+        size_t m_time{FIFO_CACHE_SIZE};
+    };
+
+    const uint32_t VALENCE_TABLE_SIZE = 32;
+
+    /// Forsyth's vertex score with the pow() calls precomputed.
+    class VertexScoreTable
+    {
+    public:
+        VertexScoreTable()
+        {
+            for (int i = 0; i < LRU_CACHE_SIZE; ++i)
+            {
+                if (i < 3)
+                {
+                    // the vertices of the last triangle get a fixed score so it isn't reused right away
+                    m_cache_scores[i] = LAST_TRIANGLE_SCORE;
+                }
+                else
+                {
+                    const float scaler = 1.0f / (LRU_CACHE_SIZE - 3);
+                    m_cache_scores[i] = std::pow(1.0f - float(i - 3) * scaler, CACHE_DECAY_POWER);
+                }
+            }
+            for (uint32_t i = 1; i < VALENCE_TABLE_SIZE; ++i)
+                m_valence_scores[i] = valenceScore(i);
+        }
+
+        float operator()(int cache_position, uint32_t remaining_triangles) const
+        {
+            if (0 == remaining_triangles)
+                return -1.0f;
+
+            const float cache_score = 0 <= cache_position ? m_cache_scores[cache_position] : 0.0f;
+            const float valence_score = remaining_triangles < VALENCE_TABLE_SIZE ? m_valence_scores[remaining_triangles]
+                                                                                 : valenceScore(remaining_triangles);
+            return cache_score + valence_score;
+        }
+
+    private:
+        /// favours vertices with few triangles left so they don't stay around as orphans
+        static float valenceScore(uint32_t remaining_triangles)
+        {
+            return VALENCE_BOOST_SCALE * std::pow(float(remaining_triangles), -VALENCE_BOOST_POWER);
+        }
+
+        float m_cache_scores[LRU_CACHE_SIZE];
+        float m_valence_scores[VALENCE_TABLE_SIZE] = {};
+    };
+}
+
+
+MeshOptimizer::VertexCacheStatistics& MeshOptimizer::VertexCacheStatistics::operator+=(
+    const VertexCacheStatistics& other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    transformed += other.transformed;
+    return *this;
+}
+
+MeshOptimizer::VertexCacheStatistics MeshOptimizer::analyzeVertexCache(const std::vector<Face>& faces,
+                                                                        size_t vertex_count)
+{
+    VertexCacheStatistics stats;
+    stats.triangles = faces.size();
+    stats.vertices = vertex_count;
+
+    FifoCache cache(vertex_count);
+    for (const Face& face: faces)
+        stats.transformed += cache.addTriangle(face);
+    return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(std::vector<Face>& faces, size_t vertex_count)
+{
+    if (faces.empty())
+        return;
+
+    // vertex -> triangle adjacency in one flat array
+    std::vector<uint32_t> remaining(vertex_count, 0);
+    for (const Face& face: faces)
+        for (uint32_t v: face)
+            ++remaining[v];
+
+    std::vector<uint32_t> first_triangle(vertex_count + 1, 0);
+    std::partial_sum(remaining.begin(), remaining.end(), first_triangle.begin() + 1);
+
+    std::vector<uint32_t> adjacency(first_triangle.back());
+    {
+        std::vector<uint32_t> fill(first_triangle.begin(), first_triangle.end() - 1);
+        for (uint32_t t = 0; t < faces.size(); ++t)
+            for (uint32_t v: faces[t])
+                adjacency[fill[v]++] = t;
+    }
+
+    const VertexScoreTable vertexScore;
+    std::vector<float> vertex_scores(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+        vertex_scores[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<float> triangle_scores(faces.size());
+    for (size_t t = 0; t < faces.size(); ++t)
+    {
+        const Face& face = faces[t];
+        triangle_scores[t] = vertex_scores[face[0]] + vertex_scores[face[1]] + vertex_scores[face[2]];
+    }
+
+    std::vector<bool> emitted(faces.size(), false);
+    std::vector<Face> result;
+    result.reserve(faces.size());
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> new_cache;
+    cache.reserve(LRU_CACHE_SIZE + 3);
+    new_cache.reserve(LRU_CACHE_SIZE + 3);
+
+    uint32_t best_triangle = static_cast<uint32_t>(std::max_element(triangle_scores.begin(), triangle_scores.end())
+                                                   - triangle_scores.begin());
+    size_t next_unemitted = 0;
+
+    while (result.size() < faces.size())
+    {
+        if (UNUSED == best_triangle)
+        {
+            // nothing adjacent to the cache is left, continue with the next triangle in input order
+            while (emitted[next_unemitted])
+                ++next_unemitted;
+            best_triangle = static_cast<uint32_t>(next_unemitted);
+        }
+
+        const Face face = faces[best_triangle];
+        emitted[best_triangle] = true;
+        result.push_back(face);
+
+        for (uint32_t v: face)
+        {
+            // drop the triangle from the vertex' adjacency list
+            uint32_t* begin = &adjacency[first_triangle[v]];
+            uint32_t* end = begin + remaining[v];
+            *std::find(begin, end, best_triangle) = *(end - 1);
+            --remaining[v];
+        }
+
+        // LRU update, the triangle's vertices move to the front
+        new_cache.assign(face.begin(), face.end());
+        for (uint32_t v: cache)
+        {
+            if (v != face[0] && v != face[1] && v != face[2])
+                new_cache.push_back(v);
+        }
+
+        best_triangle = UNUSED;
+        float best_score = -1.0f;
+        for (size_t i = 0; i < new_cache.size(); ++i)
+        {
+            const uint32_t v = new_cache[i];
+            const int position = i < static_cast<size_t>(LRU_CACHE_SIZE) ? static_cast<int>(i) : -1;
+
+            const float score = vertexScore(position, remaining[v]);
+            const float delta = score - vertex_scores[v];
+            vertex_scores[v] = score;
+
+            for (uint32_t k = 0; k < remaining[v]; ++k)
+            {
+                const uint32_t t = adjacency[first_triangle[v] + k];
+                triangle_scores[t] += delta;
+                if (triangle_scores[t] > best_score)
+                {
+                    best_score = triangle_scores[t];
+                    best_triangle = t;
+                }
+            }
+        }
+
+        new_cache.resize(std::min(new_cache.size(), static_cast<size_t>(LRU_CACHE_SIZE)));
+        cache.swap(new_cache);
+    }
+
+    faces.swap(result);
+}
+
+void MeshOptimizer::optimizeOverdraw(std::vector<Face>& faces, const std::vector<Vec3D>& positions, float threshold)
+{
+    if (faces.empty())
+        return;
+
+    const double mesh_acmr = analyzeVertexCache(faces, positions.size()).acmr();
+
+    // greedy clustering, a cluster is closed as soon as it reuses vertices nearly as well as the whole mesh
+    std::vector<size_t> cluster_begin{0};
+    {
+        FifoCache cache(positions.size());
+        size_t misses = 0;
+        for (size_t t = 0; t < faces.size(); ++t)
+        {
+            misses += cache.addTriangle(faces[t]);
+            const size_t cluster_size = t + 1 - cluster_begin.back();
+            if (double(misses) <= threshold * mesh_acmr * double(cluster_size) && t + 1 < faces.size())
+            {
+                cluster_begin.push_back(t + 1);
+                cache.reset();
+                misses = 0;
+            }
+        }
+    }
+    cluster_begin.push_back(faces.size());
+
+    const size_t cluster_count = cluster_begin.size() - 1;
+    if (cluster_count < 2)
+        return;
+
+    // area weighted centroid and normal of the mesh and every cluster
+    std::vector<std::array<double, 3>> centroids(cluster_count, {{0.0, 0.0, 0.0}});
+    std::vector<std::array<double, 3>> normals(cluster_count, {{0.0, 0.0, 0.0}});
+    std::array<double, 3> mesh_centroid = {{0.0, 0.0, 0.0}};
+    double mesh_area = 0.0;
+
+    for (size_t c = 0; c < cluster_count; ++c)
+    {
+        double cluster_area = 0.0;
+        for (size_t t = cluster_begin[c]; t < cluster_begin[c + 1]; ++t)
+        {
+            const Vec3D& p0 = positions[faces[t][0]];
+            const Vec3D& p1 = positions[faces[t][1]];
+            const Vec3D& p2 = positions[faces[t][2]];
+
+            const double e1[3] = {p1.x - p0.x, p1.y - p0.y, p1.z - p0.z};
+            const double e2[3] = {p2.x - p0.x, p2.y - p0.y, p2.z - p0.z};
+            const double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                                 e1[0] * e2[1] - e1[1] * e2[0]};
+            const double area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            const double center[3] = {(p0.x + p1.x + p2.x) / 3.0, (p0.y + p1.y + p2.y) / 3.0,
+                                      (p0.z + p1.z + p2.z) / 3.0};
+
+            for (int i = 0; i < 3; ++i)
+            {
+                centroids[c][i] += center[i] * area;
+                normals[c][i] += n[i];
+            }
+            cluster_area += area;
+        }
+
+        for (int i = 0; i < 3; ++i)
+            mesh_centroid[i] += centroids[c][i];
+        if (0.0 < cluster_area)
+        {
+            for (int i = 0; i < 3; ++i)
+                centroids[c][i] /= cluster_area;
+        }
+        mesh_area += cluster_area;
+    }
+    if (0.0 < mesh_area)
+    {
+        for (int i = 0; i < 3; ++i)
+            mesh_centroid[i] /= mesh_area;
+    }
+
+    // clusters far out along their own normal occlude the rest, so they go first
+    std::vector<double> sort_keys(cluster_count);
+    for (size_t c = 0; c < cluster_count; ++c)
+    {
+        const std::array<double, 3>& n = normals[c];
+        const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        double key = 0.0;
+        for (int i = 0; i < 3; ++i)
+            key += (centroids[c][i] - mesh_centroid[i]) * n[i];
+        sort_keys[c] = 0.0 < length ? key / length : 0.0;
+    }
+
+    std::vector<size_t> order(cluster_count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&sort_keys](size_t lhs, size_t rhs) { return sort_keys[lhs] > sort_keys[rhs]; });
+
+    std::vector<Face> result;
+    result.reserve(faces.size());
+    for (size_t c: order)
+        result.insert(result.end(), faces.begin() + cluster_begin[c], faces.begin() + cluster_begin[c + 1]);
+    faces.swap(result);
+}
+
+std::vector<uint32_t> MeshOptimizer::optimizeVertexFetch(std::vector<Face>& faces, size_t vertex_count)
+{
+    std::vector<uint32_t> remap(vertex_count, UNUSED);
+    uint32_t next = 0;
+    for (Face& face: faces)
+    {
+        for (uint32_t& v: face)
+        {
+            if (UNUSED == remap[v])
+                remap[v] = next++;
+            v = remap[v];
+        }
+    }
+    return remap;
+}
+
+uint32_t MeshOptimizer::weldPositions(const std::vector<Vec3D>& positions, std::vector<uint32_t>* ids)
+{
+    std::vector<uint32_t> order(positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&positions](uint32_t a, uint32_t b) {
+        const Vec3D& pa = positions[a];
+        const Vec3D& pb = positions[b];
+        return std::tie(pa.x, pa.y, pa.z) < std::tie(pb.x, pb.y, pb.z);
+    });
+
+    ids->resize(positions.size());
+    uint32_t id_count = 0;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (0 < i && positions[order[i]] != positions[order[i - 1]])
+            ++id_count;
+        (*ids)[order[i]] = id_count;
+    }
+    return positions.empty() ? 0 : id_count + 1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+struct Vec3D;
+
+
+/// Index and vertex reordering for better GPU vertex reuse and less overdraw.
+///
+/// The usual order is optimizeVertexCache(), optimizeOverdraw() on its result and finally
+/// optimizeVertexFetch(), which renumbers vertices in the order the GPU first reads them.
+class MeshOptimizer
+{
+public:
+    using Face = std::array<uint32_t, 3>;
+
+    /// Transformed vertex counts of a simulated FIFO post-transform cache.
+    struct VertexCacheStatistics
+    {
+        size_t triangles{0};
+        size_t vertices{0};
+        size_t transformed{0};
+
+        double acmr() const { return triangles ? double(transformed) / double(triangles) : 0.0; } ///< per triangle
+        double atvr() const { return vertices ? double(transformed) / double(vertices) : 0.0; }   ///< per vertex
+
+        VertexCacheStatistics& operator+=(const VertexCacheStatistics& other);
+    };
+
+    static VertexCacheStatistics analyzeVertexCache(const std::vector<Face>& faces, size_t vertex_count);
+
+    /// Tom Forsyth's linear-speed vertex cache optimization.
+    static void optimizeVertexCache(std::vector<Face>& faces, size_t vertex_count);
+
+    /// Splits the cache optimized order into clusters whose ACMR stays within threshold of the
+    /// whole mesh and draws outward facing clusters first (Sander et al., Tipsify).
+    static void optimizeOverdraw(std::vector<Face>& faces, const std::vector<Vec3D>& positions,
+                                 float threshold = 1.05f);
+
+    /// Renumbers vertices by first use and rewrites faces accordingly. Returns the old to new
+    /// index table, unreferenced vertices map to UINT32_MAX.
+    static std::vector<uint32_t> optimizeVertexFetch(std::vector<Face>& faces, size_t vertex_count);
+
+    /// Gives vertices with the same position, which only differ in their other attributes, a common id.
+    /// Returns the number of ids.
+    static uint32_t weldPositions(const std::vector<Vec3D>& positions, std::vector<uint32_t>* ids);
+};
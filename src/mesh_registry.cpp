@@ -0,0 +1,22 @@
+#include "mesh_registry.h"
+
+#include "mesh.h"
+#include "util.h"
+
+#include <iterator>
+
+
+std::shared_ptr<Mesh> MeshRegistry::acquire(const QString& key, const std::function<std::unique_ptr<Mesh>()>& create)
+{
+    // keys of meshes that are gone would otherwise pile up over a session
+    for (auto it = m_meshes.begin(); it != m_meshes.end();)
+        it = it->second.expired() ? m_meshes.erase(it) : std::next(it);
+
+    std::weak_ptr<Mesh>& entry = m_meshes[key];
+    if (std::shared_ptr<Mesh> mesh = entry.lock())
+        return mesh;
+
+    std::shared_ptr<Mesh> mesh = create();
+    entry = mesh;
+    return mesh;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QString>
+
+#include <functional>
+#include <map>
+#include <memory>
+
+
+class Mesh;
+
+
+/// Shares generated meshes between render objects showing the same geometry.
+///
+/// Entries are keyed by a name the caller derives from the generator and its parameters and only
+/// hold weak references, a mesh goes away with the last render object using it. Shared meshes are
+/// uploaded once and their objects end up in the same instanced draw.
+class MeshRegistry
+{
+public:
+    /// Returns the live mesh registered under key, or registers and returns the one create() builds.
+    std::shared_ptr<Mesh> acquire(const QString& key, const std::function<std::unique_ptr<Mesh>()>& create);
+
+    size_t size() const { return m_meshes.size(); } ///< includes expired entries until the next acquire()
+
+private:
+    std::map<QString, std::weak_ptr<Mesh>> m_meshes;
+};
@@ -0,0 +1,299 @@
+#include "mesh_simplifier.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+
+namespace
+{
+    /// A collapse must not turn a triangle by more than ~75 degrees, which also rejects flips.
+    const double MIN_NORMAL_COSINE = 0.25;
+
+    std::array<double, 3> faceNormal(const Vec3D& p0, const Vec3D& p1, const Vec3D& p2)
+    {
+        const double e1[3] = {p1.x - p0.x, p1.y - p0.y, p1.z - p0.z};
+        const double e2[3] = {p2.x - p0.x, p2.y - p0.y, p2.z - p0.z};
+        return {{e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]}};
+    }
+
+    double dot(const std::array<double, 3>& a, const std::array<double, 3>& b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    bool contains(const MeshSimplifier::Face& face, uint32_t v)
+    {
+        return face[0] == v || face[1] == v || face[2] == v;
+    }
+}
+
+
+MeshSimplifier::Quadric& MeshSimplifier::Quadric::operator+=(const Quadric& other)
+{
+    a00 += other.a00;
+    a01 += other.a01;
+    a02 += other.a02;
+    a11 += other.a11;
+    a12 += other.a12;
+    a22 += other.a22;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+    weight += other.weight;
+    return *this;
+}
+
+double MeshSimplifier::Quadric::evaluate(const Vec3D& p) const
+{
+    const double x = p.x;
+    const double y = p.y;
+    const double z = p.z;
+    const double error = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                         + 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return 0.0 < weight ? std::max(error, 0.0) / weight : 0.0;
+}
+
+
+MeshSimplifier::MeshSimplifier(const std::vector<Face>& faces, const std::vector<Vec3D>& positions)
+    : m_positions(positions)
+    , m_faces(faces)
+{
+    computeQuadrics();
+    lockBorderAndSeamVertices();
+}
+
+void MeshSimplifier::computeQuadrics()
+{
+    m_quadrics.assign(m_positions.size(), Quadric{0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0});
+
+    for (const Face& face: m_faces)
+    {
+        const Vec3D& p0 = m_positions[face[0]];
+        std::array<double, 3> n = faceNormal(p0, m_positions[face[1]], m_positions[face[2]]);
+        const double length = std::sqrt(dot(n, n));
+        if (0.0 == length)
+            continue;
+        for (double& c: n)
+            c /= length;
+
+        const double area = 0.5 * length;
+        const double d = -(n[0] * p0.x + n[1] * p0.y + n[2] * p0.z);
+        const Quadric plane{area * n[0] * n[0], area * n[0] * n[1], area * n[0] * n[2], area * n[1] * n[1],
+                            area * n[1] * n[2], area * n[2] * n[2], area * n[0] * d,    area * n[1] * d,
+                            area * n[2] * d,    area * d * d,       area};
+        for (uint32_t v: face)
+            m_quadrics[v] += plane;
+    }
+}
+
+void MeshSimplifier::lockBorderAndSeamVertices()
+{
+    const size_t vertex_count = m_positions.size();
+
+    std::vector<uint32_t> group;
+    const uint32_t group_count = MeshOptimizer::weldPositions(m_positions, &group);
+
+    std::vector<char> referenced(vertex_count, 0);
+    for (const Face& face: m_faces)
+    {
+        for (uint32_t v: face)
+            referenced[v] = 1;
+    }
+
+    // a seam is a position used by more than one referenced vertex
+    std::vector<uint32_t> wedges(group_count, 0);
+    for (size_t v = 0; v < vertex_count; ++v)
+        wedges[group[v]] += referenced[v];
+    std::vector<char> group_locked(group_count, 0);
+    for (uint32_t g = 0; g < group_count; ++g)
+        group_locked[g] = wedges[g] > 1;
+
+    // edges of a closed manifold surface are shared by exactly two faces, everything else is a border
+    std::vector<uint64_t> edges;
+    edges.reserve(3 * m_faces.size());
+    for (const Face& face: m_faces)
+    {
+        for (int e = 0; e < 3; ++e)
+        {
+            const uint64_t a = group[face[e]];
+            const uint64_t b = group[face[(e + 1) % 3]];
+            if (a != b)
+                edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i])
+            ++j;
+        if (2 != j - i)
+        {
+            group_locked[edges[i] >> 32] = 1;
+            group_locked[edges[i] & 0xFFFFFFFF] = 1;
+        }
+        i = j;
+    }
+
+    m_locked.resize(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+        m_locked[v] = group_locked[group[v]];
+}
+
+void MeshSimplifier::buildAdjacency()
+{
+    m_adjacency_offsets.assign(m_positions.size() + 1, 0);
+    for (const Face& face: m_faces)
+    {
+        for (uint32_t v: face)
+            ++m_adjacency_offsets[v + 1];
+    }
+    std::partial_sum(m_adjacency_offsets.begin(), m_adjacency_offsets.end(), m_adjacency_offsets.begin());
+
+    m_adjacency.resize(3 * m_faces.size());
+    std::vector<uint32_t> fill(m_adjacency_offsets.begin(), m_adjacency_offsets.end() - 1);
+    for (size_t f = 0; f < m_faces.size(); ++f)
+    {
+        for (uint32_t v: m_faces[f])
+            m_adjacency[fill[v]++] = static_cast<uint32_t>(f);
+    }
+}
+
+bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to, const std::vector<char>& touched) const
+{
+    std::vector<uint32_t> from_neighbours;
+    size_t shared_faces = 0;
+    for (uint32_t i = m_adjacency_offsets[from]; i < m_adjacency_offsets[from + 1]; ++i)
+    {
+        const Face& face = m_faces[m_adjacency[i]];
+        for (uint32_t v: face)
+        {
+            // the faces around from are about to change, another collapse this pass already changed them
+            if (touched[v])
+                return false;
+            if (v != from && v != to)
+                from_neighbours.push_back(v);
+        }
+        if (contains(face, to))
+        {
+            ++shared_faces;
+            continue;
+        }
+
+        std::array<uint32_t, 3> moved = face;
+        std::replace(moved.begin(), moved.end(), from, to);
+        const std::array<double, 3> n0 = faceNormal(m_positions[face[0]], m_positions[face[1]], m_positions[face[2]]);
+        const std::array<double, 3> n1 =
+            faceNormal(m_positions[moved[0]], m_positions[moved[1]], m_positions[moved[2]]);
+        if (dot(n0, n1) <= MIN_NORMAL_COSINE * std::sqrt(dot(n0, n0) * dot(n1, n1)))
+            return false;
+    }
+
+    // link condition: the only vertices next to both ends may be the tips of the faces on the edge,
+    // otherwise the collapse would pinch the surface into a non-manifold edge
+    std::vector<uint32_t> to_neighbours;
+    for (uint32_t i = m_adjacency_offsets[to]; i < m_adjacency_offsets[to + 1]; ++i)
+    {
+        for (uint32_t v: m_faces[m_adjacency[i]])
+        {
+            if (v != from && v != to)
+                to_neighbours.push_back(v);
+        }
+    }
+    std::sort(from_neighbours.begin(), from_neighbours.end());
+    from_neighbours.erase(std::unique(from_neighbours.begin(), from_neighbours.end()), from_neighbours.end());
+    std::sort(to_neighbours.begin(), to_neighbours.end());
+    to_neighbours.erase(std::unique(to_neighbours.begin(), to_neighbours.end()), to_neighbours.end());
+
+    std::vector<uint32_t> common;
+    std::set_intersection(from_neighbours.begin(), from_neighbours.end(), to_neighbours.begin(), to_neighbours.end(),
+                          std::back_inserter(common));
+    return common.size() == shared_faces;
+}
+
+bool MeshSimplifier::simplify(size_t target_face_count, float max_error)
+{
+    const double max_cost = double(max_error) * double(max_error);
+    bool collapsed = false;
+
+    // every pass picks the cheapest collapse of each vertex and applies the non overlapping ones in order
+    while (m_faces.size() > target_face_count)
+    {
+        buildAdjacency();
+
+        std::vector<Collapse> collapses;
+        for (uint32_t v = 0; v < m_positions.size(); ++v)
+        {
+            if (m_locked[v])
+                continue;
+
+            Collapse best{max_cost, v, v};
+            for (uint32_t i = m_adjacency_offsets[v]; i < m_adjacency_offsets[v + 1]; ++i)
+            {
+                for (uint32_t to: m_faces[m_adjacency[i]])
+                {
+                    if (to == v)
+                        continue;
+                    Quadric merged = m_quadrics[v];
+                    merged += m_quadrics[to];
+                    const double cost = merged.evaluate(m_positions[to]);
+                    if (cost <= best.cost)
+                        best = {cost, v, to};
+                }
+            }
+            if (best.to != v)
+                collapses.push_back(best);
+        }
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+        std::vector<uint32_t> remap(m_positions.size());
+        std::iota(remap.begin(), remap.end(), 0);
+        std::vector<char> touched(m_positions.size(), 0);
+        const size_t faces_to_remove = m_faces.size() - target_face_count;
+        size_t removed = 0;
+
+        for (const Collapse& collapse: collapses)
+        {
+            if (removed >= faces_to_remove)
+                break;
+            if (touched[collapse.from] || touched[collapse.to] || !canCollapse(collapse.from, collapse.to, touched))
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            m_quadrics[collapse.to] += m_quadrics[collapse.from];
+            for (uint32_t i = m_adjacency_offsets[collapse.from]; i < m_adjacency_offsets[collapse.from + 1]; ++i)
+            {
+                const Face& face = m_faces[m_adjacency[i]];
+                for (uint32_t v: face)
+                    touched[v] = 1;
+                removed += contains(face, collapse.to);
+            }
+            // the merged quadric keeps every original plane, so this is the distance to the full mesh
+            m_error = std::max(m_error, static_cast<float>(std::sqrt(collapse.cost)));
+        }
+        if (0 == removed)
+            break;
+
+        std::vector<Face> faces;
+        faces.reserve(m_faces.size() - removed);
+        for (const Face& face: m_faces)
+        {
+            const Face moved = {{remap[face[0]], remap[face[1]], remap[face[2]]}};
+            if (moved[0] != moved[1] && moved[1] != moved[2] && moved[2] != moved[0])
+                faces.push_back(moved);
+        }
+        m_faces.swap(faces);
+        collapsed = true;
+    }
+
+    return collapsed;
+}
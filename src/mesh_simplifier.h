@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+struct Vec3D;
+
+
+/// Quadric error metric simplification (Garland and Heckbert) by collapsing vertices onto neighbours.
+///
+/// Vertices are only removed, never moved or created, so every level of detail indexes the vertex
+/// buffer of the original mesh. Vertices on open borders and on attribute seams (several vertices
+/// with the same position) stay in place, which keeps the silhouette and texture mapping intact.
+class MeshSimplifier
+{
+public:
+    using Face = MeshOptimizer::Face;
+
+    MeshSimplifier(const std::vector<Face>& faces, const std::vector<Vec3D>& positions);
+
+    /// Continues collapsing until at most target_face_count faces are left or the next collapse would
+    /// exceed max_error. Returns false if nothing could be collapsed.
+    bool simplify(size_t target_face_count, float max_error);
+
+    const std::vector<Face>& faces() const { return m_faces; }
+    /// Largest collapse cost so far as a distance in object space, the area weighted RMS distance of the
+    /// kept vertices to the original faces around them. It's an estimate, not a strict bound.
+    float error() const { return m_error; }
+
+private:
+    /// Symmetric 4x4 matrix of summed squared plane distances, weighted by triangle area.
+    struct Quadric
+    {
+        double a00, a01, a02, a11, a12, a22; ///< plane normal outer product
+        double b0, b1, b2;                   ///< normal * plane offset
+        double c;                            ///< squared plane offset
+        double weight;                       ///< summed area, to turn the error into a distance
+
+        Quadric& operator+=(const Quadric& other);
+        double evaluate(const Vec3D& p) const;
+    };
+
+    struct Collapse
+    {
+        double cost;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    void computeQuadrics();
+    void lockBorderAndSeamVertices();
+    void buildAdjacency();
+    bool canCollapse(uint32_t from, uint32_t to, const std::vector<char>& touched) const;
+
+private:
+    const std::vector<Vec3D>& m_positions;
+    std::vector<Face> m_faces;
+    std::vector<Quadric> m_quadrics;
+    std::vector<char> m_locked;
+
+    // vertex to face adjacency of m_faces, rebuilt before every pass
+    std::vector<uint32_t> m_adjacency_offsets;
+    std::vector<uint32_t> m_adjacency;
+
+    float m_error{0.0f};
+};
@@ -0,0 +1,348 @@
+#include "mesh_subdivider.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+
+namespace
+{
+    const size_t MIN_ITEMS_PER_THREAD = 1 << 14; ///< smaller meshes are not worth spawning threads for
+
+    /// Runs work(begin, end) on equal slices of [0, count), the first one on the calling thread.
+    template <typename Work>
+    void parallelFor(size_t count, Work work)
+    {
+        const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+        const size_t slice_count = std::max<size_t>(1, std::min(thread_count, count / MIN_ITEMS_PER_THREAD));
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < slice_count; ++i)
+            workers.emplace_back(work, i * count / slice_count, (i + 1) * count / slice_count);
+        work(size_t{0}, count / slice_count);
+        for (auto& worker: workers)
+            worker.join();
+    }
+
+    uint64_t edgeKey(uint32_t a, uint32_t b)
+    {
+        return uint64_t{std::min(a, b)} << 32 | std::max(a, b);
+    }
+
+    uint32_t edgeStart(uint64_t key) { return static_cast<uint32_t>(key >> 32); }
+    uint32_t edgeEnd(uint64_t key) { return static_cast<uint32_t>(key & 0xFFFFFFFF); }
+
+    /// Unique undirected edges of a triangle list. Face edge e of face f is entry 3 * f + e.
+    struct EdgeTable
+    {
+        std::vector<uint64_t> keys;            ///< per edge
+        std::vector<uint32_t> representatives; ///< per edge, one face edge that uses it
+        std::vector<uint32_t> face_edges;      ///< per face edge, the edge it belongs to
+    };
+
+    /// Buckets the face edges by their smaller vertex, which leaves only a handful of candidates to
+    /// deduplicate per vertex and keeps the table linear in time. ids optionally renames the vertices.
+    EdgeTable buildEdgeTable(const std::vector<MeshSubdivider::Face>& faces, const std::vector<uint32_t>* ids,
+                             size_t vertex_count)
+    {
+        const size_t face_edge_count = 3 * faces.size();
+        const auto key = [&](size_t face_edge) {
+            const MeshSubdivider::Face& face = faces[face_edge / 3];
+            const uint32_t a = face[face_edge % 3];
+            const uint32_t b = face[(face_edge + 1) % 3];
+            return ids ? edgeKey((*ids)[a], (*ids)[b]) : edgeKey(a, b);
+        };
+
+        std::vector<uint32_t> bucket_offsets(vertex_count + 1, 0);
+        for (size_t i = 0; i < face_edge_count; ++i)
+            ++bucket_offsets[edgeStart(key(i)) + 1];
+        std::partial_sum(bucket_offsets.begin(), bucket_offsets.end(), bucket_offsets.begin());
+        std::vector<uint32_t> buckets(face_edge_count);
+        {
+            std::vector<uint32_t> fill(bucket_offsets.begin(), bucket_offsets.end() - 1);
+            for (size_t i = 0; i < face_edge_count; ++i)
+                buckets[fill[edgeStart(key(i))]++] = static_cast<uint32_t>(i);
+        }
+
+        // the first face edge of every unique key in a bucket owns the edge
+        const auto isFirst = [&](uint32_t bucket_begin, uint32_t i, uint64_t k) {
+            for (uint32_t j = bucket_begin; j < i; ++j)
+            {
+                if (key(buckets[j]) == k)
+                    return false;
+            }
+            return true;
+        };
+
+        std::vector<uint32_t> edge_offsets(vertex_count + 1, 0);
+        parallelFor(vertex_count, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v)
+            {
+                for (uint32_t i = bucket_offsets[v]; i < bucket_offsets[v + 1]; ++i)
+                    edge_offsets[v + 1] += isFirst(bucket_offsets[v], i, key(buckets[i]));
+            }
+        });
+        std::partial_sum(edge_offsets.begin(), edge_offsets.end(), edge_offsets.begin());
+
+        EdgeTable table;
+        table.keys.resize(edge_offsets.back());
+        table.representatives.resize(edge_offsets.back());
+        table.face_edges.resize(face_edge_count);
+        parallelFor(vertex_count, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v)
+            {
+                uint32_t next = edge_offsets[v];
+                for (uint32_t i = bucket_offsets[v]; i < bucket_offsets[v + 1]; ++i)
+                {
+                    const uint64_t k = key(buckets[i]);
+                    if (isFirst(bucket_offsets[v], i, k))
+                    {
+                        table.keys[next] = k;
+                        table.representatives[next] = buckets[i];
+                        table.face_edges[buckets[i]] = next++;
+                        continue;
+                    }
+                    for (uint32_t j = edge_offsets[v]; j < next; ++j)
+                    {
+                        if (table.keys[j] == k)
+                            table.face_edges[buckets[i]] = j;
+                    }
+                }
+            }
+        });
+
+        return table;
+    }
+
+    Vec3D weighted(const Vec3D& a, float weight_a, const Vec3D& b, float weight_b)
+    {
+        return {a.x * weight_a + b.x * weight_b, a.y * weight_a + b.y * weight_b, a.z * weight_a + b.z * weight_b};
+    }
+
+    Vec3D normalizedOr(const Vec3D& v, const Vec3D& fallback)
+    {
+        const float length = v.length();
+        return 0.0f < length ? Vec3D{v.x / length, v.y / length, v.z / length} : fallback;
+    }
+
+    /// Positions of the original vertices after Loop smoothing and the welded edge table for the edge rule.
+    struct LoopTopology
+    {
+        std::vector<uint32_t> groups;                   ///< vertex to welded position
+        std::vector<Vec3D> group_positions;             ///< before smoothing
+        std::vector<Vec3D> smoothed_positions;          ///< per group
+        EdgeTable edges;                                ///< of the welded mesh
+        std::vector<uint32_t> face_counts;              ///< per welded edge
+        std::vector<std::array<uint32_t, 2>> opposites; ///< per welded edge, the groups across from it
+    };
+
+    LoopTopology buildLoopTopology(const std::vector<MeshSubdivider::Face>& faces, const std::vector<Vec3D>& positions)
+    {
+        const Vec3D zero{0.0f, 0.0f, 0.0f};
+
+        LoopTopology topology;
+        const uint32_t group_count = MeshOptimizer::weldPositions(positions, &topology.groups);
+        const std::vector<uint32_t>& groups = topology.groups;
+        topology.group_positions.assign(group_count, zero);
+        for (size_t v = 0; v < positions.size(); ++v)
+            topology.group_positions[groups[v]] = positions[v];
+
+        topology.edges = buildEdgeTable(faces, &groups, group_count);
+        const size_t edge_count = topology.edges.keys.size();
+        topology.face_counts.assign(edge_count, 0);
+        topology.opposites.assign(edge_count, {{0, 0}});
+        for (size_t i = 0; i < topology.edges.face_edges.size(); ++i)
+        {
+            const uint32_t edge = topology.edges.face_edges[i];
+            if (topology.face_counts[edge] < 2)
+                topology.opposites[edge][topology.face_counts[edge]] = groups[faces[i / 3][(i + 2) % 3]];
+            ++topology.face_counts[edge];
+        }
+
+        // one-ring sums, edges without exactly two faces are creases
+        std::vector<Vec3D> ring_sums(group_count, zero);
+        std::vector<Vec3D> crease_sums(group_count, zero);
+        std::vector<uint32_t> valences(group_count, 0);
+        std::vector<uint32_t> creases(group_count, 0);
+        const std::vector<Vec3D>& p = topology.group_positions;
+        for (size_t edge = 0; edge < edge_count; ++edge)
+        {
+            const uint32_t a = edgeStart(topology.edges.keys[edge]);
+            const uint32_t b = edgeEnd(topology.edges.keys[edge]);
+            if (a == b)
+                continue;
+
+            ring_sums[a] = ring_sums[a] + p[b];
+            ring_sums[b] = ring_sums[b] + p[a];
+            ++valences[a];
+            ++valences[b];
+            if (2 != topology.face_counts[edge])
+            {
+                crease_sums[a] = crease_sums[a] + p[b];
+                crease_sums[b] = crease_sums[b] + p[a];
+                ++creases[a];
+                ++creases[b];
+            }
+        }
+
+        topology.smoothed_positions.assign(group_count, zero);
+        parallelFor(group_count, [&](size_t begin, size_t end) {
+            for (size_t g = begin; g < end; ++g)
+            {
+                if (0 < creases[g])
+                {
+                    // corners and non-manifold vertices stay where they are
+                    topology.smoothed_positions[g] = 2 == creases[g] ? weighted(p[g], 0.75f, crease_sums[g], 0.125f)
+                                                                     : p[g];
+                }
+                else if (0 < valences[g])
+                {
+                    const float n = static_cast<float>(valences[g]);
+                    const float beta = 3 == valences[g] ? 3.0f / 16.0f : 3.0f / (8.0f * n);
+                    topology.smoothed_positions[g] = weighted(p[g], 1.0f - n * beta, ring_sums[g], beta);
+                }
+                else
+                {
+                    topology.smoothed_positions[g] = p[g];
+                }
+            }
+        });
+
+        return topology;
+    }
+
+    Vec3D loopEdgePoint(const LoopTopology& topology, uint32_t face_edge)
+    {
+        const uint32_t edge = topology.edges.face_edges[face_edge];
+        const uint32_t a = edgeStart(topology.edges.keys[edge]);
+        const uint32_t b = edgeEnd(topology.edges.keys[edge]);
+        const std::vector<Vec3D>& p = topology.group_positions;
+        if (a == b || 2 != topology.face_counts[edge])
+            return weighted(p[a], 0.5f, p[b], 0.5f);
+
+        const std::array<uint32_t, 2>& opposite = topology.opposites[edge];
+        return weighted(p[a] + p[b], 0.375f, p[opposite[0]] + p[opposite[1]], 0.125f);
+    }
+
+    /// Area weighted face normals summed per position, so texture seams don't show up in the shading.
+    void computeSmoothNormals(const std::vector<MeshSubdivider::Face>& faces, const std::vector<Vec3D>& positions,
+                              std::vector<Vec3D>& normals)
+    {
+        const Vec3D zero{0.0f, 0.0f, 0.0f};
+        std::vector<uint32_t> groups;
+        const uint32_t group_count = MeshOptimizer::weldPositions(positions, &groups);
+
+        std::vector<Vec3D> sums(group_count, zero);
+        for (const MeshSubdivider::Face& face: faces)
+        {
+            const Vec3D& p0 = positions[face[0]];
+            const Vec3D e1 = weighted(positions[face[1]], 1.0f, p0, -1.0f);
+            const Vec3D e2 = weighted(positions[face[2]], 1.0f, p0, -1.0f);
+            const Vec3D n{e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x};
+            for (uint32_t v: face)
+                sums[groups[v]] = sums[groups[v]] + n;
+        }
+
+        parallelFor(positions.size(), [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v)
+                normals[v] = normalizedOr(sums[groups[v]], normals[v]);
+        });
+    }
+}
+
+
+void MeshSubdivider::subdivide(std::vector<Face>& faces, std::vector<Vec3D>& positions, std::vector<Vec3D>& normals,
+                               std::vector<std::pair<float, float>>& texcoords, Scheme scheme)
+{
+    const size_t vertex_count = positions.size();
+    const size_t face_count = faces.size();
+
+    // edge e gets the new vertex vertex_count + e
+    const EdgeTable table = buildEdgeTable(faces, nullptr, vertex_count);
+    const size_t edge_count = table.keys.size();
+
+    LoopTopology topology;
+    if (Scheme::Loop == scheme)
+        topology = buildLoopTopology(faces, positions);
+
+    std::vector<Face> new_faces(4 * face_count);
+    parallelFor(face_count, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f)
+        {
+            uint32_t mid[3];
+            for (int e = 0; e < 3; ++e)
+                mid[e] = static_cast<uint32_t>(vertex_count + table.face_edges[3 * f + e]);
+
+            const Face& face = faces[f];
+            new_faces[4 * f + 0] = {{face[0], mid[0], mid[2]}};
+            new_faces[4 * f + 1] = {{mid[0], face[1], mid[1]}};
+            new_faces[4 * f + 2] = {{mid[2], mid[1], face[2]}};
+            new_faces[4 * f + 3] = {{mid[0], mid[1], mid[2]}};
+        }
+    });
+
+    const size_t new_vertex_count = vertex_count + edge_count;
+    std::vector<Vec3D> new_positions(new_vertex_count, Vec3D{0.0f, 0.0f, 0.0f});
+    parallelFor(vertex_count, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; ++v)
+            new_positions[v] = Scheme::Loop == scheme ? topology.smoothed_positions[topology.groups[v]] : positions[v];
+    });
+    parallelFor(edge_count, [&](size_t begin, size_t end) {
+        for (size_t e = begin; e < end; ++e)
+        {
+            const uint32_t a = edgeStart(table.keys[e]);
+            const uint32_t b = edgeEnd(table.keys[e]);
+            Vec3D& out = new_positions[vertex_count + e];
+            if (Scheme::Loop == scheme)
+            {
+                out = loopEdgePoint(topology, table.representatives[e]);
+                continue;
+            }
+
+            out = weighted(positions[a], 0.5f, positions[b], 0.5f);
+            const float length = out.length();
+            if (Scheme::Sphere == scheme && 0.0f < length)
+                out *= (positions[a].length() + positions[b].length()) / (2.0f * length);
+        }
+    });
+
+    if (!normals.empty())
+    {
+        normals.resize(new_vertex_count, Vec3D{0.0f, 0.0f, 0.0f});
+        if (Scheme::Loop != scheme)
+        {
+            parallelFor(edge_count, [&](size_t begin, size_t end) {
+                for (size_t e = begin; e < end; ++e)
+                {
+                    const Vec3D& na = normals[edgeStart(table.keys[e])];
+                    const Vec3D& nb = normals[edgeEnd(table.keys[e])];
+                    normals[vertex_count + e] = Scheme::Sphere == scheme
+                                                    ? normalizedOr(new_positions[vertex_count + e], na)
+                                                    : normalizedOr(na + nb, na);
+                }
+            });
+        }
+    }
+
+    if (!texcoords.empty())
+    {
+        texcoords.resize(new_vertex_count);
+        parallelFor(edge_count, [&](size_t begin, size_t end) {
+            for (size_t e = begin; e < end; ++e)
+            {
+                const std::pair<float, float>& ta = texcoords[edgeStart(table.keys[e])];
+                const std::pair<float, float>& tb = texcoords[edgeEnd(table.keys[e])];
+                texcoords[vertex_count + e] = {(ta.first + tb.first) / 2.0f, (ta.second + tb.second) / 2.0f};
+            }
+        });
+    }
+
+    faces.swap(new_faces);
+    positions.swap(new_positions);
+
+    if (!normals.empty() && Scheme::Loop == scheme)
+        computeSmoothNormals(faces, positions, normals);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cinttypes>
+#include <utility>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+struct Vec3D;
+
+
+/// Splits every triangle into four.
+///
+/// The new vertices are looked up in an edge table, so neighbouring faces share their edge vertices
+/// and the result stays watertight. Vertices that only differ in normal or texcoord are treated as
+/// one point by the smoothing rules, which keeps attribute seams from cracking open.
+class MeshSubdivider
+{
+public:
+    using Face = MeshOptimizer::Face;
+
+    enum class Scheme
+    {
+        Midpoint, ///< flat, new vertices at the edge midpoints
+        Sphere,   ///< midpoints pushed out to the distance of their edge from the origin
+        Loop,     ///< Loop's smooth approximating scheme, open borders are kept as creases
+    };
+
+    /// Subdivides once, normals and texcoords may be empty. Loop recomputes smooth normals.
+    static void subdivide(std::vector<Face>& faces, std::vector<Vec3D>& positions, std::vector<Vec3D>& normals,
+                          std::vector<std::pair<float, float>>& texcoords, Scheme scheme);
+};
@@ -0,0 +1,137 @@
+#include "model_loader.h"
+
+#include "asset_loader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "texture_cache.h"
+
+#include <QDebug>
+
+#include <chrono>
+
+
+ModelLoader::ModelLoader(TextureCache& texture_cache)
+    : m_texture_cache(texture_cache)
+{
+    m_worker = std::thread(&ModelLoader::run, this);
+}
+
+ModelLoader::~ModelLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+        m_cancel = true;
+    }
+    m_job_available.notify_one();
+    m_worker.join();
+}
+
+void ModelLoader::load(const QString& obj_file, const Vec3D& position)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back({obj_file, position});
+    }
+    m_job_available.notify_one();
+}
+
+void ModelLoader::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.clear();
+    m_finished.clear();
+    m_cancel = true;
+}
+
+bool ModelLoader::isBusy() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_job_running || !m_jobs.empty() || !m_finished.empty();
+}
+
+std::unique_ptr<ModelLoader::LoadedMesh> ModelLoader::takeMesh()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_finished.empty())
+        return nullptr;
+
+    std::unique_ptr<LoadedMesh> loaded = std::move(m_finished.front());
+    m_finished.pop_front();
+    return loaded;
+}
+
+void ModelLoader::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_job_available.wait(lock, [this] { return m_shutdown || !m_jobs.empty(); });
+        if (m_shutdown)
+            return;
+
+        const Job job = m_jobs.front();
+        m_jobs.pop_front();
+        m_job_running = true;
+        m_cancel = false;
+
+        lock.unlock();
+        process(job);
+        lock.lock();
+
+        m_job_running = false;
+    }
+}
+
+void ModelLoader::process(const Job& job)
+{
+    const auto begin = std::chrono::steady_clock::now();
+
+    auto meshes = AssetLoader::loadObj(job.file, &m_cancel);
+    if (m_cancel)
+    {
+        qDebug() << "Cancelled loading" << job.file;
+        return;
+    }
+    if (meshes.empty())
+    {
+        qDebug() << "Could not load obj file!";
+        return;
+    }
+
+    int vertex_count = 0;
+    int face_count = 0;
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        std::unique_ptr<Mesh>& mesh = meshes[i];
+        vertex_count += mesh->getVertexCount();
+        face_count += mesh->getFaceCount();
+        mesh->buildBvh(); // here rather than on the first pick, which would stall a frame
+
+        std::shared_ptr<Texture> texture;
+        if (!mesh->getMaterial().empty())
+        {
+            texture = m_texture_cache.acquire(mesh->getMaterial());
+            if (!texture)
+            {
+                qDebug() << "Could not load texture" << mesh->getMaterial().c_str();
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancel)
+        {
+            qDebug() << "Cancelled loading" << job.file;
+            return;
+        }
+        m_finished.push_back(std::unique_ptr<LoadedMesh>(
+            new LoadedMesh{std::move(mesh), std::move(texture), job.position, job.file, i + 1 == meshes.size()}));
+    }
+
+    qDebug() << "Loaded" << meshes.size() << "meshes with" << vertex_count
+             << "vertices and" << face_count << " faces";
+    const auto end = std::chrono::steady_clock::now();
+    const auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+    qDebug() << "Loading time:" << time_diff << "ms";
+}
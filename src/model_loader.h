@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "util.h"
+
+
+class Mesh;
+class Texture;
+class TextureCache;
+
+
+/// Loads models on a background thread.
+///
+/// Parsing and vertex deduplication run on the worker. Finished meshes are queued for the render
+/// thread which takes them one by one and does the GL uploads itself, textures are decoded by the
+/// TextureStreamer.
+class ModelLoader
+{
+public:
+    struct LoadedMesh
+    {
+        std::unique_ptr<Mesh> mesh;
+        std::shared_ptr<Texture> texture; ///< not necessarily uploaded yet, may be null
+        Vec3D position;
+        QString source;
+        bool last; ///< last mesh of its model
+    };
+
+    explicit ModelLoader(TextureCache& texture_cache);
+    ~ModelLoader();
+
+    void load(const QString& obj_file, const Vec3D& position);
+    void cancel();
+
+    bool isBusy() const;
+    std::unique_ptr<LoadedMesh> takeMesh();
+
+private:
+    struct Job
+    {
+        QString file;
+        Vec3D position;
+    };
+
+    void run();
+    void process(const Job& job);
+
+private:
+    TextureCache& m_texture_cache;
+    std::thread m_worker;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    std::deque<Job> m_jobs;
+    std::deque<std::unique_ptr<LoadedMesh>> m_finished;
+    bool m_job_running{false};
+    bool m_shutdown{false};
+
+    std::atomic<bool> m_cancel{false};
+};
@@ -0,0 +1,821 @@
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <thread>
+
+
+namespace
+{
+    const size_t MIN_CHUNK_SIZE = 1 << 20; // smaller files are not worth spawning threads for
+
+    enum class CommandType
+    {
+        UseMaterial,
+        MaterialLib,
+        Group,
+        Object
+    };
+
+    /// Non-face statement of a chunk, replayed in order when the chunks are merged.
+    struct Command
+    {
+        CommandType type;
+        std::string name;
+        size_t polygon_offset; ///< polygons of the chunk preceding this command
+        size_t index_offset;   ///< triangulated indices of the chunk preceding this command
+    };
+
+    struct Corner
+    {
+        tinyobj::index_t idx;
+        bool relative_vertex;
+        bool relative_normal;
+        bool relative_texcoord;
+    };
+
+    struct Chunk
+    {
+        std::vector<float> vertices;
+        std::vector<float> normals;
+        std::vector<float> texcoords;
+
+        std::vector<tinyobj::index_t> indices; ///< triangulated face corners
+        std::vector<size_t> vertex_fixups;     ///< positions in indices holding chunk relative references
+        std::vector<size_t> normal_fixups;
+        std::vector<size_t> texcoord_fixups;
+
+        std::vector<Command> commands;
+        size_t polygon_count{0};
+
+        size_t vertexCount() const { return vertices.size() / 3; }
+        size_t normalCount() const { return normals.size() / 3; }
+        size_t texcoordCount() const { return texcoords.size() / 2; }
+
+        void addVertex(float x, float y, float z)
+        {
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+        }
+
+        void addNormal(float x, float y, float z)
+        {
+            normals.push_back(x);
+            normals.push_back(y);
+            normals.push_back(z);
+        }
+
+        void addTexCoord(float x, float y)
+        {
+            texcoords.push_back(x);
+            texcoords.push_back(y);
+        }
+
+        void addFace(const std::vector<Corner>& face);
+
+        void addCommand(CommandType type, std::string&& name)
+        {
+            commands.push_back({type, std::move(name), polygon_count, indices.size()});
+        }
+
+    private:
+        void addCorner(const Corner& corner);
+    };
+
+    void Chunk::addFace(const std::vector<Corner>& face)
+    {
+        // polygon -> triangle fan
+        for (size_t k = 2; k < face.size(); ++k)
+        {
+            addCorner(face[0]);
+            addCorner(face[k - 1]);
+            addCorner(face[k]);
+        }
+        ++polygon_count;
+    }
+
+    void Chunk::addCorner(const Corner& corner)
+    {
+        const size_t pos = indices.size();
+        if (corner.relative_vertex)
+            vertex_fixups.push_back(pos);
+        if (corner.relative_normal)
+            normal_fixups.push_back(pos);
+        if (corner.relative_texcoord)
+            texcoord_fixups.push_back(pos);
+        indices.push_back(corner.idx);
+    }
+
+    bool isSpace(char c) { return c == ' ' || c == '\t'; }
+    bool isDigit(char c) { return static_cast<unsigned int>(c - '0') < 10u; }
+    bool isWhiteSpace(char c) { return isSpace(c) || c == '\v' || c == '\f' || c == '\r' || c == '\n'; }
+
+    const char* skipSpace(const char* token, const char* end)
+    {
+        while (token != end && isSpace(*token))
+            ++token;
+        return token;
+    }
+
+    /// strcspn(token, " \t\r") bounded by the end of the line
+    const char* findFieldEnd(const char* token, const char* end)
+    {
+        while (token != end && !isSpace(*token) && *token != '\r')
+            ++token;
+        return token;
+    }
+
+    /// strcspn(token, "/ \t\r") bounded by the end of the line
+    const char* findIndexEnd(const char* token, const char* end)
+    {
+        while (token != end && *token != '/' && !isSpace(*token) && *token != '\r')
+            ++token;
+        return token;
+    }
+
+    /// Bounded copy of tinyobj's tryParseDouble so that parsed values stay bit-identical.
+    bool tryParseDouble(const char* s, const char* s_end, double* result)
+    {
+        static const double POW_LUT[] = {1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001};
+        const int lut_entries = sizeof(POW_LUT) / sizeof(POW_LUT[0]);
+
+        if (s >= s_end)
+            return false;
+
+        double mantissa = 0.0;
+        int exponent = 0;
+        char sign = '+';
+        const char* curr = s;
+
+        if (*curr == '+' || *curr == '-')
+        {
+            sign = *curr;
+            ++curr;
+        }
+        else if (!isDigit(*curr))
+        {
+            return false;
+        }
+
+        int read = 0;
+        while (curr != s_end && isDigit(*curr))
+        {
+            mantissa *= 10;
+            mantissa += static_cast<int>(*curr - '0');
+            ++curr;
+            ++read;
+        }
+        if (0 == read)
+            return false;
+
+        if (curr != s_end && *curr == '.')
+        {
+            ++curr;
+            read = 1;
+            while (curr != s_end && isDigit(*curr))
+            {
+                mantissa += static_cast<int>(*curr - '0') * (read < lut_entries ? POW_LUT[read] : std::pow(10.0, -read));
+                ++read;
+                ++curr;
+            }
+        }
+
+        if (curr != s_end && (*curr == 'e' || *curr == 'E'))
+        {
+            ++curr;
+            char exp_sign = '+';
+            if (curr != s_end && (*curr == '+' || *curr == '-'))
+            {
+                exp_sign = *curr;
+                ++curr;
+            }
+            else if (curr == s_end || !isDigit(*curr))
+            {
+                return false; // empty exponent
+            }
+
+            read = 0;
+            while (curr != s_end && isDigit(*curr))
+            {
+                exponent *= 10;
+                exponent += static_cast<int>(*curr - '0');
+                ++curr;
+                ++read;
+            }
+            exponent *= (exp_sign == '+' ? 1 : -1);
+            if (0 == read)
+                return false;
+        }
+
+        *result = (sign == '+' ? 1 : -1)
+                  * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+        return true;
+    }
+
+    float parseFloat(const char*& token, const char* end)
+    {
+        token = skipSpace(token, end);
+        const char* field_end = findFieldEnd(token, end);
+        double value = 0.0;
+        tryParseDouble(token, field_end, &value);
+        token = field_end;
+        return static_cast<float>(value);
+    }
+
+    /// atoi bounded by the end of the line
+    int parseInt(const char* token, const char* end)
+    {
+        while (token != end && isWhiteSpace(*token))
+            ++token;
+
+        bool negative = false;
+        if (token != end && (*token == '+' || *token == '-'))
+        {
+            negative = ('-' == *token);
+            ++token;
+        }
+
+        // int64_t since long is 32 bit on Windows, values beyond the range of int are clamped
+        const int64_t max_value = std::numeric_limits<int>::max();
+        int64_t value = 0;
+        while (token != end && isDigit(*token))
+        {
+            value = std::min(value * 10 + (*token - '0'), max_value);
+            ++token;
+        }
+        return static_cast<int>(negative ? -value : value);
+    }
+
+    /// Makes an index zero based. Relative indices are resolved against the attribute count known
+    /// to the handler and flagged, so chunks can add their global offset when they are merged.
+    int fixIndex(int idx, size_t count, bool* relative)
+    {
+        if (idx > 0)
+            return idx - 1;
+        if (idx == 0)
+            return 0;
+        *relative = true;
+        return static_cast<int>(count) + idx;
+    }
+
+    /// Parses i, i/j/k, i//k or i/j
+    template <typename Handler>
+    Corner parseTriple(const char*& token, const char* end, const Handler& handler)
+    {
+        Corner corner{{-1, -1, -1}, false, false, false};
+
+        corner.idx.vertex_index = fixIndex(parseInt(token, end), handler.vertexCount(), &corner.relative_vertex);
+        token = findIndexEnd(token, end);
+        if (token == end || *token != '/')
+            return corner;
+        ++token;
+
+        // i//k
+        if (token != end && *token == '/')
+        {
+            ++token;
+            corner.idx.normal_index = fixIndex(parseInt(token, end), handler.normalCount(), &corner.relative_normal);
+            token = findIndexEnd(token, end);
+            return corner;
+        }
+
+        // i/j/k or i/j
+        corner.idx.texcoord_index = fixIndex(parseInt(token, end), handler.texcoordCount(), &corner.relative_texcoord);
+        token = findIndexEnd(token, end);
+        if (token == end || *token != '/')
+            return corner;
+
+        ++token;
+        corner.idx.normal_index = fixIndex(parseInt(token, end), handler.normalCount(), &corner.relative_normal);
+        token = findIndexEnd(token, end);
+        return corner;
+    }
+
+    /// First whitespace separated word, like sscanf(token, "%s", ...)
+    std::string parseWord(const char* token, const char* end)
+    {
+        while (token != end && isWhiteSpace(*token))
+            ++token;
+        const char* word_end = token;
+        while (word_end != end && !isWhiteSpace(*word_end))
+            ++word_end;
+        return std::string(token, word_end);
+    }
+
+    bool startsWith(const char* token, const char* end, const char* keyword, size_t length)
+    {
+        return static_cast<size_t>(end - token) > length && 0 == std::strncmp(token, keyword, length)
+               && isSpace(token[length]);
+    }
+
+    template <typename Handler>
+    void parseLine(const char* token, const char* end, Handler& handler, std::vector<Corner>& face)
+    {
+        token = skipSpace(token, end);
+        if (token == end || '\0' == *token || '#' == *token)
+            return;
+
+        const ptrdiff_t length = end - token;
+        const auto at = [token, length](ptrdiff_t i) { return i < length ? token[i] : '\0'; };
+
+        if ('v' == token[0] && isSpace(at(1)))
+        {
+            token += 2;
+            const float x = parseFloat(token, end);
+            const float y = parseFloat(token, end);
+            const float z = parseFloat(token, end);
+            handler.addVertex(x, y, z);
+        }
+        else if ('v' == token[0] && 'n' == at(1) && isSpace(at(2)))
+        {
+            token += 3;
+            const float x = parseFloat(token, end);
+            const float y = parseFloat(token, end);
+            const float z = parseFloat(token, end);
+            handler.addNormal(x, y, z);
+        }
+        else if ('v' == token[0] && 't' == at(1) && isSpace(at(2)))
+        {
+            token += 3;
+            const float x = parseFloat(token, end);
+            const float y = parseFloat(token, end);
+            handler.addTexCoord(x, y);
+        }
+        else if ('f' == token[0] && isSpace(at(1)))
+        {
+            token = skipSpace(token + 2, end);
+
+            face.clear();
+            while (token != end)
+            {
+                face.push_back(parseTriple(token, end, handler));
+                while (token != end && (isSpace(*token) || '\r' == *token))
+                    ++token;
+            }
+            handler.addFace(face);
+        }
+        else if (startsWith(token, end, "usemtl", 6))
+        {
+            handler.addCommand(CommandType::UseMaterial, parseWord(token + 7, end));
+        }
+        else if (startsWith(token, end, "mtllib", 6))
+        {
+            handler.addCommand(CommandType::MaterialLib, std::string(token + 7, end));
+        }
+        else if ('g' == token[0] && isSpace(at(1)))
+        {
+            // the group name is the second word of the line, 'g' being the first
+            token = findFieldEnd(token, end);
+            token = skipSpace(token, end);
+            handler.addCommand(CommandType::Group, std::string(token, findFieldEnd(token, end)));
+        }
+        else if ('o' == token[0] && isSpace(at(1)))
+        {
+            handler.addCommand(CommandType::Object, parseWord(token + 2, end));
+        }
+    }
+
+    /// Calls func(line_begin, line_end) for every line until it returns false.
+    /// Lines end with "\n", "\r\n" or a lone "\r".
+    template <typename LineFunc>
+    void forEachLine(const char* begin, const char* end, LineFunc func)
+    {
+        const char* line = begin;
+        while (line < end)
+        {
+            const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+            if (!line_end)
+                line_end = end;
+
+            const char* segment = line;
+            while (segment < line_end)
+            {
+                const char* cr = static_cast<const char*>(std::memchr(segment, '\r', line_end - segment));
+                const char* segment_end = cr ? cr : line_end;
+                if (!func(segment, segment_end))
+                    return;
+                segment = segment_end + 1;
+            }
+
+            line = line_end + 1;
+        }
+    }
+
+    void parseChunk(const char* begin, const char* end, Chunk* chunk)
+    {
+        std::vector<Corner> face;
+        forEachLine(begin, end, [chunk, &face](const char* line, const char* line_end) {
+            parseLine(line, line_end, *chunk, face);
+            return true;
+        });
+    }
+
+    /// Every file that is tried is added to material_files, missing ones too since creating them
+    /// changes the result.
+    void loadMaterialLibs(const std::string& line, const std::string& mtl_basedir,
+                          std::vector<tinyobj::material_t>* materials, std::vector<std::string>* material_files,
+                          std::map<std::string, int>* material_map, std::string* err)
+    {
+        std::vector<std::string> filenames;
+        std::stringstream ss(line);
+        std::string item;
+        while (std::getline(ss, item, ' '))
+            filenames.push_back(item);
+
+        if (filenames.empty())
+        {
+            *err += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+            return;
+        }
+
+        tinyobj::MaterialFileReader reader(mtl_basedir);
+        for (const std::string& filename: filenames)
+        {
+            // the same path MaterialFileReader opens
+            const std::string path = mtl_basedir.empty() ? filename : mtl_basedir + '/' + filename;
+            if (material_files
+                && std::find(material_files->begin(), material_files->end(), path) == material_files->end())
+            {
+                material_files->push_back(path);
+            }
+
+            std::string err_mtl;
+            const bool ok = reader(filename, materials, material_map, &err_mtl);
+            *err += err_mtl;
+            if (ok)
+                return;
+        }
+        *err += "WARN: Failed to load material file(s). Use default material.\n";
+    }
+
+    /// Serial replay of the chunk statements, grouping faces into shapes the way tinyobj does.
+    class ShapeBuilder
+    {
+    public:
+        ShapeBuilder(const std::string& mtl_basedir, std::vector<tinyobj::shape_t>* shapes,
+                     std::vector<tinyobj::material_t>* materials, std::vector<std::string>* material_files,
+                     std::string* err)
+            : m_mtl_basedir(mtl_basedir)
+            , m_shapes(shapes)
+            , m_materials(materials)
+            , m_material_files(material_files)
+            , m_err(err)
+        {
+        }
+
+        void addChunk(const Chunk& chunk)
+        {
+            size_t polygon_pos = 0;
+            size_t index_pos = 0;
+            for (const Command& cmd: chunk.commands)
+            {
+                addFaces(chunk, polygon_pos, cmd.polygon_offset, index_pos, cmd.index_offset);
+                polygon_pos = cmd.polygon_offset;
+                index_pos = cmd.index_offset;
+                execute(cmd);
+            }
+            addFaces(chunk, polygon_pos, chunk.polygon_count, index_pos, chunk.indices.size());
+        }
+
+        void finish()
+        {
+            if (!m_face_group_empty || !m_shape.mesh.indices.empty())
+                m_shapes->push_back(std::move(m_shape));
+        }
+
+    private:
+        void addFaces(const Chunk& chunk, size_t polygon_begin, size_t polygon_end, size_t index_begin,
+                      size_t index_end)
+        {
+            if (polygon_begin == polygon_end)
+                return;
+
+            m_face_group_empty = false;
+            m_shape.name = m_name;
+
+            const size_t triangle_count = (index_end - index_begin) / 3;
+            tinyobj::mesh_t& mesh = m_shape.mesh;
+            mesh.indices.insert(mesh.indices.end(), chunk.indices.begin() + index_begin,
+                                chunk.indices.begin() + index_end);
+            mesh.num_face_vertices.insert(mesh.num_face_vertices.end(), triangle_count, 3);
+            mesh.material_ids.insert(mesh.material_ids.end(), triangle_count, m_material);
+        }
+
+        void execute(const Command& cmd)
+        {
+            switch (cmd.type)
+            {
+                case CommandType::UseMaterial:
+                {
+                    const auto it = m_material_map.find(cmd.name);
+                    const int material = (it != m_material_map.end()) ? it->second : -1;
+                    if (material != m_material)
+                    {
+                        m_face_group_empty = true; // faces so far keep the previous material
+                        m_material = material;
+                    }
+                    break;
+                }
+                case CommandType::MaterialLib:
+                    loadMaterialLibs(cmd.name, m_mtl_basedir, m_materials, m_material_files, &m_material_map, m_err);
+                    break;
+                case CommandType::Group:
+                case CommandType::Object:
+                    if (!m_face_group_empty)
+                        m_shapes->push_back(std::move(m_shape));
+                    m_shape = tinyobj::shape_t();
+                    m_face_group_empty = true;
+                    m_name = cmd.name;
+                    break;
+            }
+        }
+
+    private:
+        const std::string& m_mtl_basedir;
+        std::vector<tinyobj::shape_t>* m_shapes;
+        std::vector<tinyobj::material_t>* m_materials;
+        std::vector<std::string>* m_material_files;
+        std::string* m_err;
+
+        std::map<std::string, int> m_material_map;
+        tinyobj::shape_t m_shape;
+        std::string m_name;
+        int m_material{-1};
+        bool m_face_group_empty{true};
+    };
+
+    struct StatementCounts
+    {
+        size_t vertices{0};
+        size_t normals{0};
+        size_t texcoords{0};
+        std::vector<size_t> shape_triangles{std::vector<size_t>(1, 0)}; ///< one entry per 'g'/'o' separated shape
+    };
+
+    /// Cheap classification of a line for the counting pass, no numbers are parsed.
+    void countLine(const char* token, const char* end, StatementCounts& counts)
+    {
+        token = skipSpace(token, end);
+        if (token == end)
+            return;
+
+        const ptrdiff_t length = end - token;
+        const auto at = [token, length](ptrdiff_t i) { return i < length ? token[i] : '\0'; };
+
+        if ('v' == token[0] && isSpace(at(1)))
+        {
+            ++counts.vertices;
+        }
+        else if ('v' == token[0] && 'n' == at(1) && isSpace(at(2)))
+        {
+            ++counts.normals;
+        }
+        else if ('v' == token[0] && 't' == at(1) && isSpace(at(2)))
+        {
+            ++counts.texcoords;
+        }
+        else if ('f' == token[0] && isSpace(at(1)))
+        {
+            size_t corners = 0;
+            for (token = skipSpace(token + 2, end); token != end; token = skipSpace(token, end))
+            {
+                token = findFieldEnd(token, end);
+                ++corners;
+            }
+            if (corners > 2)
+                counts.shape_triangles.back() += corners - 2;
+        }
+        else if (('g' == token[0] || 'o' == token[0]) && isSpace(at(1)))
+        {
+            counts.shape_triangles.push_back(0);
+        }
+    }
+
+    /// Second pass of the streaming mode, attributes go straight into the presized attrib arrays
+    /// and triangles are forwarded to the sink.
+    class StreamHandler
+    {
+    public:
+        StreamHandler(const std::string& mtl_basedir, const StatementCounts& counts, tinyobj::attrib_t* attrib,
+                      std::vector<tinyobj::material_t>* materials, std::vector<std::string>* material_files,
+                      std::string* err, ObjParser::Sink* sink)
+            : m_mtl_basedir(mtl_basedir)
+            , m_shape_triangles(counts.shape_triangles)
+            , m_attrib(attrib)
+            , m_materials(materials)
+            , m_material_files(material_files)
+            , m_err(err)
+            , m_sink(sink)
+        {
+            m_attrib->vertices.reserve(3 * counts.vertices);
+            m_attrib->normals.reserve(3 * counts.normals);
+            m_attrib->texcoords.reserve(2 * counts.texcoords);
+            m_sink->beginShape(m_shape_triangles[0]);
+        }
+
+        size_t vertexCount() const { return m_attrib->vertices.size() / 3; }
+        size_t normalCount() const { return m_attrib->normals.size() / 3; }
+        size_t texcoordCount() const { return m_attrib->texcoords.size() / 2; }
+
+        void addVertex(float x, float y, float z)
+        {
+            m_attrib->vertices.push_back(x);
+            m_attrib->vertices.push_back(y);
+            m_attrib->vertices.push_back(z);
+        }
+
+        void addNormal(float x, float y, float z)
+        {
+            m_attrib->normals.push_back(x);
+            m_attrib->normals.push_back(y);
+            m_attrib->normals.push_back(z);
+        }
+
+        void addTexCoord(float x, float y)
+        {
+            m_attrib->texcoords.push_back(x);
+            m_attrib->texcoords.push_back(y);
+        }
+
+        void addFace(const std::vector<Corner>& face)
+        {
+            m_face_group_empty = false;
+
+            // polygon -> triangle fan
+            for (size_t k = 2; k < face.size(); ++k)
+            {
+                const tinyobj::index_t triangle[3] = {face[0].idx, face[k - 1].idx, face[k].idx};
+                m_sink->addTriangle(triangle, m_material);
+                m_shape_has_triangles = true;
+            }
+        }
+
+        void addCommand(CommandType type, std::string&& name)
+        {
+            switch (type)
+            {
+                case CommandType::UseMaterial:
+                {
+                    const auto it = m_material_map.find(name);
+                    const int material = (it != m_material_map.end()) ? it->second : -1;
+                    if (material != m_material)
+                    {
+                        m_face_group_empty = true;
+                        m_material = material;
+                    }
+                    break;
+                }
+                case CommandType::MaterialLib:
+                    loadMaterialLibs(name, m_mtl_basedir, m_materials, m_material_files, &m_material_map, m_err);
+                    break;
+                case CommandType::Group:
+                case CommandType::Object:
+                    m_sink->endShape(!m_face_group_empty);
+                    ++m_shape;
+                    m_sink->beginShape(m_shape < m_shape_triangles.size() ? m_shape_triangles[m_shape] : 0);
+                    m_face_group_empty = true;
+                    m_shape_has_triangles = false;
+                    break;
+            }
+        }
+
+        void finish() { m_sink->endShape(!m_face_group_empty || m_shape_has_triangles); }
+
+    private:
+        const std::string& m_mtl_basedir;
+        const std::vector<size_t>& m_shape_triangles;
+        tinyobj::attrib_t* m_attrib;
+        std::vector<tinyobj::material_t>* m_materials;
+        std::vector<std::string>* m_material_files;
+        std::string* m_err;
+        ObjParser::Sink* m_sink;
+
+        std::map<std::string, int> m_material_map;
+        size_t m_shape{0};
+        int m_material{-1};
+        bool m_face_group_empty{true};
+        bool m_shape_has_triangles{false};
+    };
+
+    void applyFixups(std::vector<tinyobj::index_t>& indices, const std::vector<size_t>& fixups,
+                     int tinyobj::index_t::*member, size_t offset)
+    {
+        for (const size_t pos: fixups)
+            indices[pos].*member += static_cast<int>(offset);
+    }
+}
+
+
+bool ObjParser::parse(const char* data, size_t size, const std::string& mtl_basedir, tinyobj::attrib_t* attrib,
+                      std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                      std::vector<std::string>* material_files, std::string* err)
+{
+    attrib->vertices.clear();
+    attrib->normals.clear();
+    attrib->texcoords.clear();
+    shapes->clear();
+
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    const size_t chunk_count = std::max<size_t>(1, std::min(thread_count, size / MIN_CHUNK_SIZE));
+
+    // newline aligned chunk boundaries
+    std::vector<const char*> bounds{data};
+    const char* const end = data + size;
+    for (size_t i = 1; i < chunk_count; ++i)
+    {
+        const char* split = std::max(bounds.back(), data + i * (size / chunk_count));
+        const char* newline = static_cast<const char*>(std::memchr(split, '\n', end - split));
+        bounds.push_back(newline ? newline + 1 : end);
+    }
+    bounds.push_back(end);
+
+    std::vector<Chunk> chunks(chunk_count);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunk_count; ++i)
+        workers.emplace_back(parseChunk, bounds[i], bounds[i + 1], &chunks[i]);
+    parseChunk(bounds[0], bounds[1], &chunks[0]);
+    for (auto& worker: workers)
+        worker.join();
+
+    size_t vertex_count = 0;
+    size_t normal_count = 0;
+    size_t texcoord_count = 0;
+    for (const Chunk& chunk: chunks)
+    {
+        vertex_count += chunk.vertices.size();
+        normal_count += chunk.normals.size();
+        texcoord_count += chunk.texcoords.size();
+    }
+    attrib->vertices.reserve(vertex_count);
+    attrib->normals.reserve(normal_count);
+    attrib->texcoords.reserve(texcoord_count);
+
+    ShapeBuilder builder(mtl_basedir, shapes, materials, material_files, err);
+    for (Chunk& chunk: chunks)
+    {
+        applyFixups(chunk.indices, chunk.vertex_fixups, &tinyobj::index_t::vertex_index, attrib->vertices.size() / 3);
+        applyFixups(chunk.indices, chunk.normal_fixups, &tinyobj::index_t::normal_index, attrib->normals.size() / 3);
+        applyFixups(chunk.indices, chunk.texcoord_fixups, &tinyobj::index_t::texcoord_index,
+                    attrib->texcoords.size() / 2);
+
+        attrib->vertices.insert(attrib->vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+        attrib->normals.insert(attrib->normals.end(), chunk.normals.begin(), chunk.normals.end());
+        attrib->texcoords.insert(attrib->texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+
+        builder.addChunk(chunk);
+        chunk = Chunk(); // release chunk memory as early as possible
+    }
+    builder.finish();
+
+    // indices are only final once every chunk is merged, so they can't be checked while parsing
+    const auto vertices = static_cast<int64_t>(attrib->vertices.size() / 3);
+    const auto normals = static_cast<int64_t>(attrib->normals.size() / 3);
+    const auto texcoords = static_cast<int64_t>(attrib->texcoords.size() / 2);
+    for (const tinyobj::shape_t& shape: *shapes)
+    {
+        for (const tinyobj::index_t& index: shape.mesh.indices)
+        {
+            if (index.vertex_index < 0 || index.vertex_index >= vertices || index.normal_index < -1
+                || index.normal_index >= normals || index.texcoord_index < -1 || index.texcoord_index >= texcoords)
+            {
+                *err += "Vertex index out of range in shape " + shape.name + "\n";
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool ObjParser::stream(const char* data, size_t size, const std::string& mtl_basedir, tinyobj::attrib_t* attrib,
+                       std::vector<tinyobj::material_t>* materials, std::vector<std::string>* material_files,
+                       std::string* err, Sink* sink)
+{
+    attrib->vertices.clear();
+    attrib->normals.clear();
+    attrib->texcoords.clear();
+
+    StatementCounts counts;
+    forEachLine(data, data + size, [&counts](const char* line, const char* line_end) {
+        countLine(line, line_end, counts);
+        return true;
+    });
+
+    StreamHandler handler(mtl_basedir, counts, attrib, materials, material_files, err, sink);
+    std::vector<Corner> face;
+    forEachLine(data, data + size, [&handler, &face, sink](const char* line, const char* line_end) {
+        parseLine(line, line_end, handler, face);
+        return !sink->cancelled();
+    });
+    if (sink->cancelled())
+        return false;
+
+    handler.finish();
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <tinyobjloader/tiny_obj_loader.h>
+
+
+/// Multi-threaded Wavefront OBJ front end producing the same data as tinyobj::LoadObj.
+///
+/// The input is split into newline-aligned chunks which are tokenized on separate threads. The
+/// per-chunk attribute arrays are concatenated afterwards and relative face indices are fixed up
+/// with the global attribute counts. Tags ('t' lines) are not supported.
+class ObjParser
+{
+public:
+    /// Receives the triangles of ObjParser::stream in file order.
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+
+        virtual void beginShape(size_t triangle_count) = 0; ///< triangle_count is the expected total of the shape
+        virtual void addTriangle(const tinyobj::index_t* corners, int material_id) = 0;
+        virtual void endShape(bool keep) = 0; ///< keep is false for shapes tinyobj would drop
+        virtual bool cancelled() const { return false; }
+    };
+
+    /// material_files receives the paths of all referenced material libraries, it may be null.
+    static bool parse(const char* data, size_t size, const std::string& mtl_basedir, tinyobj::attrib_t* attrib,
+                      std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                      std::vector<std::string>* material_files, std::string* err);
+
+    /// Sequential import mode for very large files: a first pass counts all statements so that the
+    /// attribute arrays are allocated exactly once, the second pass hands every triangle to the
+    /// sink right away instead of building per shape index arrays.
+    static bool stream(const char* data, size_t size, const std::string& mtl_basedir, tinyobj::attrib_t* attrib,
+                       std::vector<tinyobj::material_t>* materials, std::vector<std::string>* material_files,
+                       std::string* err, Sink* sink);
+};
@@ -15,16 +15,25 @@
 
 #include "asset_loader.h"
 #include "framebuffer.h"
+#include "instanced_renderer.h"
 #include "mesh.h"
+#include "model_loader.h"
+#include "program_cache.h"
 #include "shader.h"
 #include "shape.h"
 #include "texture.h"
+#include "texture_streamer.h"
 #include "util.h"
 
 
 namespace
 {
     const float ANIMATION_SPEED = 5.0f;
+    const float FIELD_OF_VIEW = 60.0f; ///< vertical, in degrees
+    const float NEAR_PLANE = 0.1f;
+    const float FAR_PLANE = 100.0f;
+    const int SPHERE_COUNT = 100; ///< share one mesh and are drawn instanced
+    const std::chrono::milliseconds UPLOAD_BUDGET{4}; ///< time per frame spent on uploading loaded meshes
     const uint_fast16_t RESOLUTION_WIDTH = 1920;
     const uint_fast16_t RESOLUTION_HEIGHT = 1080;
 
@@ -38,9 +47,12 @@ namespace
 
 OpenGLWindow::OpenGLWindow()
   : m_camera{{1.0f, 1.0f, 0.5f}}
-  , m_framebuffer(std::make_unique<Framebuffer>())
+  , m_framebuffer(std::make_unique<Framebuffer>(m_gl_state))
   , m_frame_timer(std::make_unique<QTimer>())
   , m_logger(std::make_unique<QOpenGLDebugLogger>())
+  , m_texture_streamer(std::make_unique<TextureStreamer>())
+  , m_model_loader(std::make_unique<ModelLoader>(m_texture_cache))
+  , m_renderer(std::make_unique<InstancedRenderer>(m_gl_state))
 {
     m_frame_timer->setInterval(1000);
 
@@ -48,42 +60,53 @@ OpenGLWindow::OpenGLWindow()
     connect(m_frame_timer.get(), &QTimer::timeout, this, &OpenGLWindow::updateFrameTime);
 }
 
-OpenGLWindow::~OpenGLWindow() = default;
+OpenGLWindow::~OpenGLWindow()
+{
+    // textures and the staging buffer free their GL objects on destruction, which needs our context
+    makeCurrent();
+    m_objects.clear();
+    m_texture_streamer.reset();
+    m_renderer.reset();
+    m_post_process_pipeline.reset();
+    doneCurrent();
+}
 
 void OpenGLWindow::initializeGL()
 {
+    m_startup_timer.start();
     initializeOpenGLFunctions();
+    m_gl_state.initialize();
 
     DEBUG_CALL(m_logger->initialize());
     DEBUG_CALL(m_logger->startLogging(QOpenGLDebugLogger::SynchronousLogging));
 
     m_framebuffer->initialize(RESOLUTION_WIDTH, RESOLUTION_HEIGHT);
-
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    m_texture_streamer->initialize();
+    m_renderer->initialize();
 
     // shaders for framebuffer quad
-    m_post_process_shader = std::make_unique<Shader>();
-    m_post_process_shader->addShaderFromSourceFile(QOpenGLShader::Vertex, getShaderPath("post_process_vs.glsl"));
-    m_post_process_shader->addShaderFromSourceFile(QOpenGLShader::Fragment, getShaderPath("post_process_fs.glsl"));
-    if (!m_post_process_shader->link())
+    auto post_process_shader = std::make_shared<Shader>();
+    post_process_shader->addShaderFromSourceFile(QOpenGLShader::Vertex, getShaderPath("post_process_vs.glsl"));
+    post_process_shader->addShaderFromSourceFile(QOpenGLShader::Fragment, getShaderPath("post_process_fs.glsl"));
+    if (!post_process_shader->link())
     {
-        qDebug() << m_post_process_shader->log();
+        qDebug() << post_process_shader->log();
     }
     // char buffer[512];
     // glGetShaderInfoLog(m_program->shaders()[0]->shaderId(), 512, nullptr, buffer);
     // qDebug() << buffer;
 
-    m_post_process_shader->attributeLocation("position");
-    m_post_process_shader->uniformLocation("tex");
-
-    // vbo for a quad
+    // vbo for a quad, the pipeline creates its vao, meshes bring their own vaos
     GLfloat quad[] = {-1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f};
-    glGenBuffers(1, &m_vbo_quad);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_quad);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glCreateBuffers(1, &m_vbo_quad);
+    glNamedBufferStorage(m_vbo_quad, sizeof(quad), quad, 0);
+
+    Pipeline::RasterState post_process_raster;
+    post_process_raster.depth_test = false; // fb does not have depth
+    post_process_raster.depth_write = true; // glClear() of the next frame obeys it
+    const Pipeline::VertexFormat quad_format{m_vbo_quad, 2 * sizeof(GLfloat), {{"position", 2, GL_FLOAT, 0}}};
+    m_post_process_pipeline = std::make_unique<Pipeline>(std::move(post_process_shader), post_process_raster,
+                                                         quad_format);
 
 
     {
@@ -99,24 +122,23 @@ void OpenGLWindow::initializeGL()
         mesh->addFace({2, 3, 0});
         plane->setMesh(std::move(mesh));
 
-        plane->setVertexShader(getShaderPath("texture_noshade_vs.glsl"));
-        plane->setFragmentShader(getShaderPath("texture_noshade_fs.glsl"));
-
-        auto tex = std::make_unique<Texture>();
-        if (tex->loadFromFile("assets/textures/checker_board_128x128.png"))
+        std::shared_ptr<Texture> tex = m_texture_cache.acquire("assets/textures/checker_board_128x128.png");
+        if (tex && tex->upload())
         {
             tex->setMinMagFilters(GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
             tex->setAnisotropicFilteringLevel(16);
             tex->setWrappingST(GL_REPEAT, GL_REPEAT);
-            plane->setTexture(std::move(tex));
+            plane->setTexture(tex);
         }
 
+        plane->setPipeline(getPipeline("texture_noshade_vs.glsl", "texture_noshade_fs.glsl", Pipeline::RasterState()));
+
         m_objects.push_back(std::move(plane));
     }
 
     float j = 0.0f;
     float k = 0.0f;
-    for (int i=0; i<0; ++i)
+    for (int i=0; i<SPHERE_COUNT; ++i)
     {
         /// create sphere
         auto sphere = std::make_unique<RenderObject>();
@@ -129,12 +151,11 @@ void OpenGLWindow::initializeGL()
         sphere->translate(j, k, 0.0f);
         sphere->setAnimRotation(5.0f);
 
-        sphere->setCullFaceMode(true);
-
-        sphere->setMesh(Mesh::createSubDivSphere(0.5f, 4));
+        sphere->setMesh(m_mesh_registry.acquire("sphere:0.5:4", [] { return Mesh::createSubDivSphere(0.5f, 4); }));
 
-        sphere->setVertexShader(getShaderPath("normal_vs.glsl"));
-        sphere->setFragmentShader(getShaderPath("normal_fs.glsl"));
+        Pipeline::RasterState raster;
+        raster.cull_faces = true;
+        sphere->setPipeline(getPipeline("normal_vs.glsl", "normal_fs.glsl", raster));
 
         m_objects.push_back(std::move(sphere));
     }
@@ -148,71 +169,80 @@ void OpenGLWindow::initializeGL()
 }
 
 void OpenGLWindow::loadObject(const QString& obj_file)
+{
+    const Vec3D new_obj_pos = (m_camera.getPosition() + m_camera.getViewDirection());
+    m_model_loader->load(obj_file, new_obj_pos);
+}
+
+void OpenGLWindow::uploadLoadedMeshes()
 {
     const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
-    auto meshes = AssetLoader::loadObj(obj_file);
-    if (meshes.empty())
+    while (std::chrono::steady_clock::now() - begin < UPLOAD_BUDGET)
     {
-        qDebug() << "Could not load obj file!";
-        return;
-    }
-
-    const Vec3D new_obj_pos = (m_camera.getPosition() + m_camera.getViewDirection());
+        std::unique_ptr<ModelLoader::LoadedMesh> loaded = m_model_loader->takeMesh();
+        if (!loaded)
+            break;
 
-    int vertex_count = 0;
-    int face_count = 0;
-    for (std::unique_ptr<Mesh>& mesh: meshes)
-    {
         auto obj = std::make_unique<RenderObject>();
-        obj->translate(new_obj_pos);
+        obj->translate(loaded->position);
         obj->rotate(90.0f);
 
-        vertex_count += mesh->getVertexCount();
-        face_count += mesh->getFaceCount();
-//            mesh->scale(0.01f);
-        if (!mesh->getMaterial().empty())
+        // translucent materials are blended, which the MTL file tells before any texels are loaded
+        Pipeline::RasterState raster;
+        raster.blend = loaded->mesh->isTranslucent();
+        raster.depth_write = !raster.blend; // transparent objects must not hide each other, they are sorted
+        if (loaded->texture)
         {
-            auto tex = std::make_unique<Texture>();
-            if (tex->loadFromFile(mesh->getMaterial()))
-            {
-                tex->setMinMagFilters(GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
-                tex->setWrappingST(GL_REPEAT, GL_REPEAT);
-                obj->setTexture(std::move(tex));
-            }
-            else
+            // shared textures are only streamed in by the first mesh using them, until the pixels
+            // arrive the object samples the undefined but complete storage
+            if (!loaded->texture->isCreated())
             {
-                qDebug() << "Could not load texture" << mesh->getMaterial().c_str();
-                return;
+                loaded->texture->create();
+                loaded->texture->setMinMagFilters(GL_LINEAR_MIPMAP_LINEAR, GL_NEAREST);
+                loaded->texture->setWrappingST(GL_REPEAT, GL_REPEAT);
+                m_texture_streamer->request(loaded->texture);
             }
-            obj->setVertexShader(getShaderPath("texture_noshade_vs.glsl"));
-            obj->setFragmentShader(getShaderPath("texture_noshade_fs.glsl"));
+            obj->setTexture(std::move(loaded->texture));
+            obj->setPipeline(getPipeline("texture_noshade_vs.glsl", "texture_noshade_fs.glsl", raster));
         }
         else
         {
-            obj->setVertexShader(getShaderPath("normal_vs.glsl"));
-            obj->setFragmentShader(getShaderPath("normal_fs.glsl"));
+            obj->setPipeline(getPipeline("normal_vs.glsl", "normal_fs.glsl", raster));
         }
-        obj->setMesh(std::move(mesh));
+        obj->setMesh(std::move(loaded->mesh));
 
         obj->initGL();
+        m_model_gpu_memory += obj->getMesh()->getGpuMemory();
+        m_model_uncompressed_gpu_memory += obj->getMesh()->getUncompressedGpuMemory();
         m_objects.push_back(std::move(obj));
-    }
 
-    qDebug() << "Loaded" << meshes.size() << "meshes with" << vertex_count
-             << "vertices and" << face_count << " faces";
-    const auto end= std::chrono::steady_clock::now();
-    const auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
-    qDebug() << "Loading time:" << time_diff << "ms";
+        if (loaded->last)
+        {
+            qDebug() << "Finished uploading" << loaded->source;
+            qDebug() << "Mesh buffers:" << m_model_gpu_memory / 1024 << "KiB, saved"
+                     << (m_model_uncompressed_gpu_memory - m_model_gpu_memory) / 1024 << "KiB";
+            m_model_gpu_memory = 0;
+            m_model_uncompressed_gpu_memory = 0;
+            qDebug() << "Texture cache:" << m_texture_cache.hits() << "hits," << m_texture_cache.misses()
+                     << "misses," << m_texture_cache.residentBytes() / 1024 << "KiB resident";
+        }
+    }
 }
 
 void OpenGLWindow::paintGL()
 {
+    uploadLoadedMeshes();
+    m_texture_streamer->update();
+    m_gl_state.beginFrame();
+
     const qreal retinaScale = devicePixelRatio();
-    glViewport(0, 0, static_cast<GLsizei>(width() * retinaScale), static_cast<GLsizei>(height() * retinaScale));
+    m_gl_state.viewport(0, 0, static_cast<GLsizei>(width() * retinaScale),
+                        static_cast<GLsizei>(height() * retinaScale));
 
-    QMatrix4x4 proj;
-    proj.perspective(60.0f, width() / (float)height(), 0.1f, 100.0f);
+    const QMatrix4x4 proj = getProjection();
+    const float lod_scale = static_cast<float>(height() * retinaScale)
+                            / (2.0f * std::tan(qDegreesToRadians(FIELD_OF_VIEW) / 2.0f));
 
     // re-direct rendering to frame buffer
     m_framebuffer->clear();
@@ -220,40 +250,76 @@ void OpenGLWindow::paintGL()
     /// object rendering
     {
         const QMatrix4x4 pv = proj * m_camera.get_view();
+        const Vec3D camera_position = m_camera.getPosition();
+        const QVector3D eye(camera_position.x, camera_position.y, camera_position.z);
 
-        for (auto& object: m_objects)
+        if (m_animating)
         {
-            if (m_animating)
+            for (auto& object: m_objects)
                 object->animate();
-            object->render(pv);
         }
+
+        // new objects need a new hierarchy, moving ones are refitted until that made it too loose
+        if (m_scene.size() != m_objects.size())
+        {
+            rebuildScene();
+        }
+        else if (m_animating)
+        {
+            for (uint32_t id = 0; id < m_objects.size(); ++id)
+                m_scene.update(id, m_objects[id]->getBoundingBox(), m_objects[id]->getBoundingSphere());
+            m_scene.refit();
+            if (m_scene.needsRebuild())
+                rebuildScene();
+        }
+        m_scene.cull(m_camera.getFrustumPlanes(proj), m_visible_objects);
+        emit objectsCulled(static_cast<int>(m_visible_objects.size()),
+                           static_cast<int>(m_objects.size() - m_visible_objects.size()));
+
+        for (uint32_t index: m_visible_objects)
+        {
+            RenderObject& object = *m_objects[index];
+            m_renderer->add(object, object.selectLod(eye, lod_scale));
+        }
+        m_renderer->draw(pv);
     }
 
     // switch back to back buffer
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glDisable(GL_DEPTH_TEST); // fb does not have depth
+    m_gl_state.bindDrawFramebuffer(0);
 
 
     /// post processing
 
-    m_post_process_shader->bind();
+    m_post_process_pipeline->bind(m_gl_state);
 
     m_framebuffer->bind_color_texture();
 
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo_quad);
-    glVertexAttribPointer(m_post_process_shader->attributeLocation("position"), 2, GL_FLOAT, GL_FALSE, 0,
-                          nullptr); // nullptr == uses currently bound buffer e.g. m_vbo_quad
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
-    m_post_process_shader->release();
+    // clean up, Qt expects nothing bound outside of paintGL()
+    m_gl_state.useProgram(0);
+    m_gl_state.bindVertexArray(0);
+    m_gl_state.bindTextureUnit(0, 0);
 
-    // clean up
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glActiveTexture(GL_TEXTURE0); // make sure we unbind the correct texture slot
-    glBindTexture(GL_TEXTURE_2D, 0);
+    const GlState::Statistics& gl_calls = m_gl_state.getStatistics();
+    emit renderStatistics(static_cast<int>(m_renderer->getStatistics().batches), static_cast<int>(gl_calls.issued),
+                          static_cast<int>(gl_calls.filtered));
 
     ++m_frame_counter;
+
+    if (m_startup_timer.isValid())
+    {
+        glFinish(); // include the GPU work of the first frame, e.g. shader compilation deferred by the driver
+        qDebug() << "Time to first frame:" << m_startup_timer.elapsed() << "ms";
+        m_startup_timer.invalidate();
+    }
+}
+
+void OpenGLWindow::cancelLoading()
+{
+    m_model_loader->cancel();
+    m_model_gpu_memory = 0;
+    m_model_uncompressed_gpu_memory = 0;
 }
 
 void OpenGLWindow::setAnimating(bool animating)
@@ -263,10 +329,15 @@ void OpenGLWindow::setAnimating(bool animating)
 
 void OpenGLWindow::showWireFrame(bool status)
 {
+    // pipelines are immutable, objects switch to the variant with the other polygon mode
+    makeCurrent();
     for (auto& object: m_objects)
     {
-        object->setWireframeMode(status);
+        Pipeline::RasterState raster = object->getPipeline()->getRasterState();
+        raster.wireframe = status;
+        object->setPipeline(m_pipeline_cache.get(object->getPipeline()->getProgram(), raster));
     }
+    doneCurrent();
     requestUpdate();
 }
 
@@ -287,6 +358,81 @@ void OpenGLWindow::handle_log_message(const QOpenGLDebugMessage& msg)
     }
 }
 
+bool OpenGLWindow::pick(const QPoint& cursor, PickResult& result)
+{
+    // the ray runs from the near to the far plane, t in [0, 1]
+    const QMatrix4x4 inverse_pv = (getProjection() * m_camera.get_view()).inverted();
+    const float x = 2.0f * (static_cast<float>(cursor.x()) + 0.5f) / static_cast<float>(width()) - 1.0f;
+    const float y = 1.0f - 2.0f * (static_cast<float>(cursor.y()) + 0.5f) / static_cast<float>(height());
+    const QVector3D near_point = inverse_pv.map(QVector3D(x, y, -1.0f));
+    const QVector3D far_point = inverse_pv.map(QVector3D(x, y, 1.0f));
+    const QVector3D direction = far_point - near_point;
+
+    if (m_scene.size() != m_objects.size())
+        rebuildScene();
+    m_scene.raycast(near_point, direction, 1.0f, m_pick_candidates);
+
+    // candidates come sorted by where the ray enters their boxes, none behind the closest hit can be closer
+    MeshBvh::Hit best;
+    best.t = 1.0f;
+    uint32_t best_object = SceneBvh::INVALID_ID;
+    for (const std::pair<float, uint32_t>& candidate: m_pick_candidates)
+    {
+        if (candidate.first > best.t)
+            break;
+        RenderObject& object = *m_objects[candidate.second];
+        Mesh* mesh = object.getMesh();
+        if (!mesh)
+            continue;
+        mesh->buildBvh();
+
+        // an unnormalized direction keeps t the same in model and world space
+        const QMatrix4x4 to_model = object.getModelMatrix().inverted();
+        const QVector3D origin = to_model.map(near_point);
+        const QVector3D model_direction = to_model.mapVector(direction);
+        const MeshBvh::Hit hit = mesh->getBvh()->intersect(
+            {{{origin.x(), origin.y(), origin.z()}}, {{model_direction.x(), model_direction.y(), model_direction.z()}},
+             best.t});
+        if (MeshBvh::INVALID_FACE != hit.face)
+        {
+            best = hit;
+            best_object = candidate.second;
+        }
+    }
+
+    if (SceneBvh::INVALID_ID == best_object)
+        return false;
+    result = {m_objects[best_object].get(), best.face, near_point + best.t * direction};
+    return true;
+}
+
+std::shared_ptr<const Pipeline> OpenGLWindow::getPipeline(const QString& vertex_file, const QString& fragment_file,
+                                                          const Pipeline::RasterState& raster)
+{
+    return m_pipeline_cache.get(m_program_cache.get(getShaderPath(vertex_file), getShaderPath(fragment_file)), raster);
+}
+
+QMatrix4x4 OpenGLWindow::getProjection() const
+{
+    QMatrix4x4 proj;
+    proj.perspective(FIELD_OF_VIEW, width() / (float)height(), NEAR_PLANE, FAR_PLANE);
+    return proj;
+}
+
+void OpenGLWindow::rebuildScene()
+{
+    std::vector<BoundingBox> boxes;
+    std::vector<BoundingSphere> spheres;
+    boxes.reserve(m_objects.size());
+    spheres.reserve(m_objects.size());
+    for (const auto& object: m_objects)
+    {
+        boxes.push_back(object->getBoundingBox());
+        spheres.push_back(object->getBoundingSphere());
+    }
+    m_scene.build(boxes, spheres);
+}
+
 void OpenGLWindow::resizeGL(int width, int height)
 {
     m_framebuffer->resize(width, height);
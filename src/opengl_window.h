@@ -1,20 +1,31 @@
 #pragma once
 
+#include <QElapsedTimer>
 #include <QOpenGLFunctions_4_5_Core>
 #include <QOpenGLWindow>
 
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "camera.h"
+#include "gl_state.h"
+#include "mesh_registry.h"
+#include "pipeline_cache.h"
+#include "program_cache.h"
+#include "scene_bvh.h"
+#include "texture_cache.h"
 
 
 class Framebuffer;
+class InstancedRenderer;
+class ModelLoader;
 class RenderObject;
 class QOpenGLDebugLogger;
 class QOpenGLDebugMessage;
 class QOpenGLShaderProgram;
 class QTimer;
-class Shader;
+class TextureStreamer;
 
 
 class OpenGLWindow : public QOpenGLWindow, protected QOpenGLFunctions_4_5_Core
@@ -22,6 +33,13 @@ class OpenGLWindow : public QOpenGLWindow, protected QOpenGLFunctions_4_5_Core
     Q_OBJECT
 
 public:
+    struct PickResult
+    {
+        RenderObject* object;
+        uint32_t triangle; ///< face of the object's mesh at full detail
+        QVector3D position; ///< of the hit, in world space
+    };
+
     OpenGLWindow();
     ~OpenGLWindow() override;
 
@@ -29,11 +47,16 @@ public:
     void paintGL() override;
 
     void loadObject(const QString& obj_file);
+    /// Closest object triangle under cursor, given in window coordinates. Returns false if nothing is hit.
+    bool pick(const QPoint& cursor, PickResult& result);
 
 signals:
     void frameTime(float time_in_ms);
+    void objectsCulled(int visible, int culled); ///< every frame
+    void renderStatistics(int batches, int issued_gl_calls, int filtered_gl_calls); ///< every frame
 
 public slots:
+    void cancelLoading();
     void setAnimating(bool animating);
     void showWireFrame(bool status);
     void updateFrameTime();
@@ -42,23 +65,43 @@ private slots:
     void handle_log_message(const QOpenGLDebugMessage& msg);
 
 private:
+    std::shared_ptr<const Pipeline> getPipeline(const QString& vertex_file, const QString& fragment_file,
+                                                const Pipeline::RasterState& raster);
+    QMatrix4x4 getProjection() const;
+    void rebuildScene();
     void resizeGL(int width, int height) override;
+    void uploadLoadedMeshes();
 
 public:
     Camera m_camera;
 
 private:
+    GlState m_gl_state; ///< everything that draws changes state through it
     std::unique_ptr<Framebuffer> m_framebuffer;
 
     std::unique_ptr<QTimer> m_frame_timer;
     uint_fast8_t m_frame_counter{0};
+    QElapsedTimer m_startup_timer; ///< from initializeGL() until the first frame is done
 
     std::unique_ptr<QOpenGLDebugLogger> m_logger;
 
-    std::unique_ptr<Shader> m_post_process_shader;
+    TextureCache m_texture_cache;
+    std::unique_ptr<TextureStreamer> m_texture_streamer;
+    std::unique_ptr<ModelLoader> m_model_loader;
+    size_t m_model_gpu_memory{0};              ///< of the model currently being uploaded
+    size_t m_model_uncompressed_gpu_memory{0}; ///< the same with float attributes and 32 bit indices
+
+    MeshRegistry m_mesh_registry;
+    ProgramCache m_program_cache;
+    PipelineCache m_pipeline_cache;
+    std::unique_ptr<InstancedRenderer> m_renderer;
+    std::unique_ptr<Pipeline> m_post_process_pipeline; ///< owns the vertex array of the quad
     GLuint m_vbo_quad;
 
     bool m_animating{false};
 
     std::vector<std::unique_ptr<RenderObject>> m_objects;
+    SceneBvh m_scene;                        ///< bounds of m_objects, ids are their indices
+    std::vector<uint32_t> m_visible_objects; ///< indices into m_objects, of the last frame
+    std::vector<std::pair<float, uint32_t>> m_pick_candidates;
 };
@@ -0,0 +1,109 @@
+#include "pipeline.h"
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+
+Pipeline::Pipeline(std::shared_ptr<Shader> program, const RasterState& raster, const VertexFormat& format)
+    : m_program(std::move(program))
+    , m_program_id(m_program->programId())
+    , m_raster(raster)
+{
+    initializeOpenGLFunctions();
+
+    // programs that failed to link are still drawn with, they just don't have an interface
+    if (m_program->isLinked())
+    {
+        reflect(GL_PROGRAM_INPUT, GL_LOCATION, m_attributes);
+        reflect(GL_UNIFORM, GL_LOCATION, m_uniforms);
+        reflect(GL_UNIFORM_BLOCK, GL_BUFFER_BINDING, m_uniform_blocks);
+    }
+
+    if (format.attributes.empty())
+        return;
+
+    const GLuint binding = 0;
+    glCreateVertexArrays(1, &m_vertex_array);
+    glVertexArrayVertexBuffer(m_vertex_array, binding, format.buffer, 0, format.stride);
+    for (const VertexAttribute& attribute: format.attributes)
+    {
+        const GLint location = getAttributeLocation(attribute.name);
+        if (location < 0)
+        {
+            qDebug() << "Vertex attribute" << attribute.name << "is not used by the program";
+            continue;
+        }
+        const auto index = static_cast<GLuint>(location);
+        glEnableVertexArrayAttrib(m_vertex_array, index);
+        glVertexArrayAttribFormat(m_vertex_array, index, attribute.components, attribute.type, GL_FALSE,
+                                  attribute.offset);
+        glVertexArrayAttribBinding(m_vertex_array, index, binding);
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    if (m_vertex_array)
+        glDeleteVertexArrays(1, &m_vertex_array);
+}
+
+void Pipeline::bind(GlState& state) const
+{
+    state.useProgram(m_program_id);
+    state.setCapability(GL_CULL_FACE, m_raster.cull_faces);
+    state.polygonMode(m_raster.wireframe ? GL_LINE : GL_FILL);
+    state.setCapability(GL_BLEND, m_raster.blend);
+    if (m_raster.blend)
+        state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state.setCapability(GL_DEPTH_TEST, m_raster.depth_test);
+    state.depthMask(m_raster.depth_write);
+    if (m_vertex_array)
+        state.bindVertexArray(m_vertex_array);
+}
+
+GLint Pipeline::getAttributeLocation(const QByteArray& name) const
+{
+    return find(m_attributes, name);
+}
+
+GLint Pipeline::getUniformLocation(const QByteArray& name) const
+{
+    return find(m_uniforms, name);
+}
+
+GLint Pipeline::getUniformBlockBinding(const QByteArray& name) const
+{
+    return find(m_uniform_blocks, name);
+}
+
+void Pipeline::reflect(GLenum interface, GLenum property, std::vector<Resource>& resources)
+{
+    GLint count = 0;
+    glGetProgramInterfaceiv(m_program_id, interface, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const GLenum properties[] = {GL_NAME_LENGTH, property};
+        GLint values[] = {0, -1};
+        glGetProgramResourceiv(m_program_id, interface, static_cast<GLuint>(i), 2, properties, 2, nullptr, values);
+        // built-in inputs and members of uniform blocks have no location of their own
+        if (values[1] < 0 || values[0] < 1)
+            continue;
+
+        QByteArray name;
+        name.resize(values[0]);
+        glGetProgramResourceName(m_program_id, interface, static_cast<GLuint>(i), values[0], nullptr, name.data());
+        name.resize(values[0] - 1); // without the terminating zero
+        resources.push_back({name, values[1]});
+    }
+}
+
+GLint Pipeline::find(const std::vector<Resource>& resources, const QByteArray& name)
+{
+    const auto it = std::find_if(resources.begin(), resources.end(),
+                                 [&name](const Resource& resource) { return resource.name == name; });
+    return it != resources.end() ? it->location : -1;
+}
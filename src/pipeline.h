@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QByteArray>
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+
+class GlState;
+class Shader;
+
+
+/// Linked program, its reflected interface, vertex format and raster state, fixed at creation.
+///
+/// Everything a draw call needs from the program is queried once in the constructor, so bind() only
+/// forwards cached values to the GlState. Pipelines without a vertex format leave the vertex array
+/// to the mesh, whose layout matches the explicit attribute locations of the scene shaders.
+class Pipeline : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    struct RasterState
+    {
+        bool cull_faces{false};
+        bool wireframe{false};
+        bool blend{false}; ///< source alpha over the destination
+        bool depth_test{true};
+        bool depth_write{true};
+
+        bool operator<(const RasterState& other) const
+        {
+            return std::tie(cull_faces, wireframe, blend, depth_test, depth_write)
+                   < std::tie(other.cull_faces, other.wireframe, other.blend, other.depth_test, other.depth_write);
+        }
+    };
+
+    /// Attribute of a single interleaved vertex buffer, located by name through the reflection.
+    struct VertexAttribute
+    {
+        QByteArray name;
+        GLint components;
+        GLenum type;
+        GLuint offset;
+    };
+
+    struct VertexFormat
+    {
+        GLuint buffer; ///< not owned
+        GLsizei stride;
+        std::vector<VertexAttribute> attributes;
+    };
+
+    Pipeline(std::shared_ptr<Shader> program, const RasterState& raster, const VertexFormat& format = VertexFormat());
+    ~Pipeline(); ///< needs the GL context to be current if there is a vertex format
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    void bind(GlState& state) const;
+
+    const std::shared_ptr<Shader>& getProgram() const { return m_program; }
+    const RasterState& getRasterState() const { return m_raster; }
+
+    /// From the reflection, -1 for names the linker removed or that don't exist.
+    GLint getAttributeLocation(const QByteArray& name) const;
+    GLint getUniformLocation(const QByteArray& name) const;
+    GLint getUniformBlockBinding(const QByteArray& name) const;
+
+private:
+    /// Active resource with its location, or binding point for blocks.
+    struct Resource
+    {
+        QByteArray name;
+        GLint location;
+    };
+
+    void reflect(GLenum interface, GLenum property, std::vector<Resource>& resources);
+    static GLint find(const std::vector<Resource>& resources, const QByteArray& name);
+
+private:
+    std::shared_ptr<Shader> m_program; ///< shared through the ProgramCache
+    GLuint m_program_id;
+    RasterState m_raster;
+    GLuint m_vertex_array{0}; ///< only with a vertex format
+
+    std::vector<Resource> m_attributes;
+    std::vector<Resource> m_uniforms; ///< outside of blocks
+    std::vector<Resource> m_uniform_blocks;
+};
@@ -0,0 +1,16 @@
+#include "pipeline_cache.h"
+
+
+std::shared_ptr<const Pipeline> PipelineCache::get(const std::shared_ptr<Shader>& program,
+                                                   const Pipeline::RasterState& raster)
+{
+    const auto key = std::make_pair(static_cast<const Shader*>(program.get()), raster);
+
+    auto it = m_pipelines.find(key);
+    if (it != m_pipelines.end())
+        return it->second;
+
+    auto pipeline = std::make_shared<const Pipeline>(program, raster);
+    m_pipelines.emplace(key, pipeline);
+    return pipeline;
+}
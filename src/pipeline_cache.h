@@ -0,0 +1,27 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "pipeline.h"
+
+
+class Shader;
+
+
+/// Hands out pipelines shared by all objects drawn with the same program and raster state.
+///
+/// Pipelines reflect their program on creation, so each combination is only queried once per context.
+/// Changing an object's raster state means switching it to another pipeline from here.
+class PipelineCache
+{
+public:
+    /// Needs the GL context to be current if the pipeline doesn't exist yet.
+    std::shared_ptr<const Pipeline> get(const std::shared_ptr<Shader>& program, const Pipeline::RasterState& raster);
+
+    size_t size() const { return m_pipelines.size(); }
+
+private:
+    std::map<std::pair<const Shader*, Pipeline::RasterState>, std::shared_ptr<const Pipeline>> m_pipelines;
+};
@@ -0,0 +1,28 @@
+#include "program_cache.h"
+
+#include "shader.h"
+
+#include <QDebug>
+
+
+std::shared_ptr<Shader> ProgramCache::get(const QString& vertex_file, const QString& fragment_file,
+                                          const QStringList& defines)
+{
+    const QString key = vertex_file + '\n' + fragment_file + '\n' + defines.join(';');
+
+    auto it = m_programs.find(key);
+    if (it != m_programs.end())
+        return it->second;
+
+    // a program that fails to link is kept as well so it isn't recompiled for every object
+    auto program = std::make_shared<Shader>();
+    program->addShaderFromSourceFile(QOpenGLShader::Vertex, vertex_file, defines);
+    program->addShaderFromSourceFile(QOpenGLShader::Fragment, fragment_file, defines);
+    if (!program->link())
+    {
+        qDebug() << program->log();
+    }
+
+    m_programs.emplace(key, program);
+    return program;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+#include <map>
+#include <memory>
+
+
+class Shader;
+
+
+/// Hands out linked programs shared by all objects using the same shader stages.
+///
+/// Programs are keyed by their vertex and fragment source files and the preprocessor defines
+/// injected into both, so each combination is compiled and linked once per context.
+class ProgramCache
+{
+public:
+    std::shared_ptr<Shader> get(const QString& vertex_file, const QString& fragment_file,
+                                const QStringList& defines = QStringList());
+
+    size_t size() const { return m_programs.size(); }
+
+private:
+    std::map<QString, std::shared_ptr<Shader>> m_programs;
+};
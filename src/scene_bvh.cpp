@@ -0,0 +1,427 @@
+#include "scene_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+
+namespace
+{
+    const uint32_t MAX_LEAF_SIZE = 4;      ///< always a leaf at or below
+    const uint32_t MAX_SAH_LEAF_SIZE = 16; ///< a leaf if splitting doesn't pay off, up to this many objects
+    const size_t BIN_COUNT = 12;
+    const float TRAVERSAL_COST = 1.0f;     ///< relative to testing one object
+    const float REBUILD_COST_RATIO = 1.5f; ///< refitted to built cost
+    const float MIN_DIRECTION = 1e-20f;    ///< smallest ray direction component in the slab test
+
+    float surfaceArea(const BoundingBox& box)
+    {
+        if (box.isEmpty())
+            return 0.0f;
+        const QVector3D e = box.extent();
+        return 2.0f * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+    }
+
+    /// Squared distance of point to the box, 0 inside.
+    float distanceSquared(const BoundingBox& box, const QVector3D& point)
+    {
+        float result = 0.0f;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float d = std::max({box.min[axis] - point[axis], point[axis] - box.max[axis], 0.0f});
+            result += d * d;
+        }
+        return result;
+    }
+
+    /// Distance along the ray where it enters the box, clamped to 0 inside, or infinity on a miss.
+    float rayEntry(const BoundingBox& box, const QVector3D& origin, const QVector3D& inverse_direction, float max_t)
+    {
+        if (box.isEmpty())
+            return std::numeric_limits<float>::infinity();
+        float t_min = 0.0f;
+        float t_max = max_t;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float t0 = (box.min[axis] - origin[axis]) * inverse_direction[axis];
+            const float t1 = (box.max[axis] - origin[axis]) * inverse_direction[axis];
+            t_min = std::max(t_min, std::min(t0, t1));
+            t_max = std::min(t_max, std::max(t0, t1));
+        }
+        return t_min <= t_max ? t_min : std::numeric_limits<float>::infinity();
+    }
+
+    bool containsBox(const BoundingBox& outer, const BoundingBox& inner)
+    {
+        return outer.contains(inner.min) && outer.contains(inner.max);
+    }
+}
+
+
+void SceneBvh::build(const std::vector<BoundingBox>& boxes, const std::vector<BoundingSphere>& spheres)
+{
+    const auto count = static_cast<uint32_t>(boxes.size());
+    m_ids.resize(count);
+    std::iota(m_ids.begin(), m_ids.end(), 0);
+
+    std::vector<QVector3D> centers(count);
+    for (uint32_t i = 0; i < count; ++i)
+        centers[i] = boxes[i].isEmpty() ? QVector3D() : boxes[i].center();
+
+    m_nodes.clear();
+    m_nodes.push_back({BoundingBox(), 0, count, 0, 0});
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back();
+        stack.pop_back();
+
+        BoundingBox bounds;
+        BoundingBox center_bounds;
+        const uint32_t first = m_nodes[index].first;
+        const uint32_t node_count = m_nodes[index].count;
+        for (uint32_t i = first; i < first + node_count; ++i)
+        {
+            bounds.extend(boxes[m_ids[i]]);
+            center_bounds.extend({centers[m_ids[i]], centers[m_ids[i]]});
+        }
+        m_nodes[index].bounds = bounds;
+        if (node_count <= MAX_LEAF_SIZE)
+            continue;
+
+        // split along the axis the centers are spread most
+        const QVector3D spread = center_bounds.extent();
+        int axis = spread.x() > spread.y() ? 0 : 1;
+        axis = spread.z() > spread[axis] ? 2 : axis;
+
+        uint32_t middle = first + node_count / 2;
+        if (spread[axis] > 0.0f)
+        {
+            const float bin_scale = BIN_COUNT / spread[axis] * (1.0f - 1e-5f);
+            const auto binOf = [&](uint32_t id) {
+                return std::min(static_cast<size_t>((centers[id][axis] - center_bounds.min[axis]) * bin_scale),
+                                BIN_COUNT - 1);
+            };
+
+            BoundingBox bin_bounds[BIN_COUNT];
+            uint32_t bin_counts[BIN_COUNT] = {};
+            for (uint32_t i = first; i < first + node_count; ++i)
+            {
+                const size_t bin = binOf(m_ids[i]);
+                bin_bounds[bin].extend(boxes[m_ids[i]]);
+                ++bin_counts[bin];
+            }
+
+            // sweep from the right to get the cost of every right side, then from the left
+            float right_costs[BIN_COUNT];
+            BoundingBox right;
+            uint32_t right_count = 0;
+            for (size_t bin = BIN_COUNT - 1; bin > 0; --bin)
+            {
+                right.extend(bin_bounds[bin]);
+                right_count += bin_counts[bin];
+                right_costs[bin] = right_count * surfaceArea(right);
+            }
+            float best_cost = node_count * surfaceArea(bounds);
+            size_t best_split = 0;
+            BoundingBox left;
+            uint32_t left_count = 0;
+            for (size_t split = 1; split < BIN_COUNT; ++split)
+            {
+                left.extend(bin_bounds[split - 1]);
+                left_count += bin_counts[split - 1];
+                const float cost = left_count * surfaceArea(left) + right_costs[split];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_split = split;
+                }
+            }
+
+            if (0 == best_split && node_count <= MAX_SAH_LEAF_SIZE)
+                continue;
+            if (0 != best_split)
+            {
+                const auto split_end =
+                    std::partition(m_ids.begin() + first, m_ids.begin() + first + node_count,
+                                   [&](uint32_t id) { return binOf(id) < best_split; });
+                middle = static_cast<uint32_t>(split_end - m_ids.begin());
+            }
+        }
+        // identical centers or no split paid off for a large node, halve it in place
+        if (middle == first || middle == first + node_count)
+            middle = first + node_count / 2;
+
+        const auto left_index = static_cast<uint32_t>(m_nodes.size());
+        m_nodes[index].left = left_index;
+        m_nodes.push_back({BoundingBox(), first, middle - first, 0, index});
+        m_nodes.push_back({BoundingBox(), middle, first + node_count - middle, 0, index});
+        stack.push_back(left_index);
+        stack.push_back(left_index + 1);
+    }
+
+    // objects in tree order, so leaves and subtrees are ranges
+    m_positions.resize(count);
+    m_boxes.resize(count);
+    m_leaves.resize(count);
+    m_culler.resize(count);
+    for (uint32_t position = 0; position < count; ++position)
+    {
+        const uint32_t id = m_ids[position];
+        m_positions[id] = position;
+        m_boxes[position] = boxes[id];
+        m_culler.set(position, boxes[id], spheres[id]);
+    }
+    for (uint32_t index = 0; index < m_nodes.size(); ++index)
+    {
+        const Node& node = m_nodes[index];
+        if (0 == node.left)
+            std::fill(m_leaves.begin() + node.first, m_leaves.begin() + node.first + node.count, index);
+    }
+
+    m_dirty.assign(m_nodes.size(), 0);
+    m_refit_pending = false;
+    m_cost = 0.0;
+    for (const Node& node: m_nodes)
+        m_cost += nodeCost(node);
+    const float root_area = m_nodes.empty() ? 0.0f : surfaceArea(m_nodes[0].bounds);
+    m_built_cost = 0.0f < root_area ? static_cast<float>(m_cost / root_area) : 0.0f;
+}
+
+void SceneBvh::update(uint32_t id, const BoundingBox& box, const BoundingSphere& sphere)
+{
+    const uint32_t position = m_positions[id];
+    m_boxes[position] = box;
+    m_culler.set(position, box, sphere);
+    m_dirty[m_leaves[position]] = 1;
+    m_refit_pending = true;
+}
+
+void SceneBvh::refit()
+{
+    if (!m_refit_pending)
+        return;
+
+    // children come after their parents, so walking backwards refits bottom up
+    for (size_t index = m_nodes.size(); index-- > 0;)
+    {
+        if (!m_dirty[index])
+            continue;
+        Node& node = m_nodes[index];
+        m_cost -= nodeCost(node);
+        updateNodeBounds(node);
+        m_cost += nodeCost(node);
+        m_dirty[index] = 0;
+        if (0 != index)
+            m_dirty[node.parent] = 1;
+    }
+    m_refit_pending = false;
+}
+
+bool SceneBvh::needsRebuild() const
+{
+    // relative to the root, moving everything together keeps the cost
+    const float root_area = m_nodes.empty() ? 0.0f : surfaceArea(m_nodes[0].bounds);
+    if (0.0f == root_area || 0.0f == m_built_cost)
+        return false;
+    return m_cost / root_area > double(REBUILD_COST_RATIO * m_built_cost);
+}
+
+void SceneBvh::updateNodeBounds(Node& node) const
+{
+    node.bounds = BoundingBox();
+    if (0 == node.left)
+    {
+        for (uint32_t position = node.first; position < node.first + node.count; ++position)
+            node.bounds.extend(m_boxes[position]);
+    }
+    else
+    {
+        node.bounds.extend(m_nodes[node.left].bounds);
+        node.bounds.extend(m_nodes[node.left + 1].bounds);
+    }
+}
+
+float SceneBvh::nodeCost(const Node& node)
+{
+    return surfaceArea(node.bounds) * (0 == node.left ? node.count : TRAVERSAL_COST);
+}
+
+void SceneBvh::cull(const FrustumCuller::Planes& planes, std::vector<uint32_t>& visible) const
+{
+    visible.clear();
+    if (m_nodes.empty())
+        return;
+
+    // every entry carries the planes its parent still intersects, nodes inside all of them need no tests
+    const uint32_t all_planes = (1u << planes.size()) - 1;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, all_planes}};
+    std::vector<uint32_t> positions;
+    while (!stack.empty())
+    {
+        const uint32_t index = stack.back().first;
+        uint32_t plane_mask = stack.back().second;
+        stack.pop_back();
+
+        const Node& node = m_nodes[index];
+        if (node.bounds.isEmpty())
+            continue;
+        const QVector3D center = node.bounds.center();
+        const QVector3D half = node.bounds.extent() / 2.0f;
+        bool outside = false;
+        for (size_t p = 0; p < planes.size() && !outside; ++p)
+        {
+            if (!(plane_mask & (1u << p)))
+                continue;
+            const QVector4D& plane = planes[p];
+            const float distance = plane.x() * center.x() + plane.y() * center.y() + plane.z() * center.z() + plane.w();
+            const float radius = std::abs(plane.x()) * half.x() + std::abs(plane.y()) * half.y()
+                                 + std::abs(plane.z()) * half.z();
+            if (distance < -radius)
+                outside = true;
+            else if (distance >= radius)
+                plane_mask &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+
+        if (0 == plane_mask)
+        {
+            visible.insert(visible.end(), m_ids.begin() + node.first, m_ids.begin() + node.first + node.count);
+        }
+        else if (0 == node.left)
+        {
+            positions.clear();
+            m_culler.cull(planes, node.first, node.first + node.count, positions);
+            for (uint32_t position: positions)
+                visible.push_back(m_ids[position]);
+        }
+        else
+        {
+            stack.push_back({node.left, plane_mask});
+            stack.push_back({node.left + 1, plane_mask});
+        }
+    }
+}
+
+void SceneBvh::query(const BoundingBox& region, std::vector<uint32_t>& result) const
+{
+    result.clear();
+    if (m_nodes.empty() || region.isEmpty())
+        return;
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (node.bounds.isEmpty() || !region.intersects(node.bounds))
+            continue;
+
+        if (containsBox(region, node.bounds))
+        {
+            result.insert(result.end(), m_ids.begin() + node.first, m_ids.begin() + node.first + node.count);
+        }
+        else if (0 == node.left)
+        {
+            for (uint32_t position = node.first; position < node.first + node.count; ++position)
+            {
+                if (!m_boxes[position].isEmpty() && region.intersects(m_boxes[position]))
+                    result.push_back(m_ids[position]);
+            }
+        }
+        else
+        {
+            stack.push_back(node.left);
+            stack.push_back(node.left + 1);
+        }
+    }
+}
+
+uint32_t SceneBvh::nearest(const QVector3D& point, float max_distance) const
+{
+    uint32_t best_id = INVALID_ID;
+    if (m_nodes.empty())
+        return best_id;
+
+    // depth first into the closer child, anything farther than the best object so far is skipped
+    float best = max_distance * max_distance;
+    std::vector<std::pair<float, uint32_t>> stack = {{distanceSquared(m_nodes[0].bounds, point), 0}};
+    while (!stack.empty())
+    {
+        const float node_distance = stack.back().first;
+        const Node& node = m_nodes[stack.back().second];
+        stack.pop_back();
+        if (node_distance > best || node.bounds.isEmpty())
+            continue;
+
+        if (0 == node.left)
+        {
+            for (uint32_t position = node.first; position < node.first + node.count; ++position)
+            {
+                if (m_boxes[position].isEmpty())
+                    continue;
+                const float distance = distanceSquared(m_boxes[position], point);
+                if (distance <= best)
+                {
+                    best = distance;
+                    best_id = m_ids[position];
+                }
+            }
+            continue;
+        }
+
+        const float left = distanceSquared(m_nodes[node.left].bounds, point);
+        const float right = distanceSquared(m_nodes[node.left + 1].bounds, point);
+        if (left < right)
+        {
+            stack.push_back({right, node.left + 1});
+            stack.push_back({left, node.left});
+        }
+        else
+        {
+            stack.push_back({left, node.left});
+            stack.push_back({right, node.left + 1});
+        }
+    }
+    return best_id;
+}
+
+void SceneBvh::raycast(const QVector3D& origin, const QVector3D& direction, float max_t,
+                       std::vector<std::pair<float, uint32_t>>& hits) const
+{
+    hits.clear();
+    if (m_nodes.empty())
+        return;
+
+    // a zero component would give 0 * inf = NaN for box planes through the origin
+    QVector3D inverse_direction;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float d = direction[axis];
+        inverse_direction[axis] = 1.0f / (std::abs(d) < MIN_DIRECTION ? std::copysign(MIN_DIRECTION, d) : d);
+    }
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (std::isinf(rayEntry(node.bounds, origin, inverse_direction, max_t)))
+            continue;
+
+        if (0 != node.left)
+        {
+            stack.push_back(node.left);
+            stack.push_back(node.left + 1);
+            continue;
+        }
+        for (uint32_t position = node.first; position < node.first + node.count; ++position)
+        {
+            const float t = rayEntry(m_boxes[position], origin, inverse_direction, max_t);
+            if (!std::isinf(t))
+                hits.emplace_back(t, m_ids[position]);
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+}
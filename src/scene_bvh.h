@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QVector3D>
+
+#include <cinttypes>
+#include <utility>
+#include <vector>
+
+#include "bounds.h"
+#include "frustum_culler.h"
+
+
+/// Bounding volume hierarchy over the bounds of the scene's objects.
+///
+/// Built top down with a binned surface area heuristic. Objects are identified by their index at
+/// build time and stored in tree order, so every subtree covers a contiguous range of them. Moving
+/// objects are handled by update() and refit(), which keep the topology; once the refitted tree is
+/// notably worse than a fresh one, needsRebuild() asks for a new build.
+class SceneBvh
+{
+public:
+    static const uint32_t INVALID_ID = UINT32_MAX;
+
+    void build(const std::vector<BoundingBox>& boxes, const std::vector<BoundingSphere>& spheres);
+    /// New bounds of an object, applied to the tree by the next refit().
+    void update(uint32_t id, const BoundingBox& box, const BoundingSphere& sphere);
+    void refit();
+    bool needsRebuild() const;
+
+    size_t size() const { return m_ids.size(); }
+
+    /// Ids of the objects at least partly inside the frustum, in no particular order.
+    void cull(const FrustumCuller::Planes& planes, std::vector<uint32_t>& visible) const;
+    /// Ids of the objects whose boxes intersect region.
+    void query(const BoundingBox& region, std::vector<uint32_t>& result) const;
+    /// Object with the closest box that is at most max_distance away, or INVALID_ID.
+    uint32_t nearest(const QVector3D& point, float max_distance) const;
+    /// Objects whose boxes the ray hits with t in [0, max_t] as (entry t, id), sorted by t.
+    void raycast(const QVector3D& origin, const QVector3D& direction, float max_t,
+                 std::vector<std::pair<float, uint32_t>>& hits) const;
+
+private:
+    struct Node
+    {
+        BoundingBox bounds;
+        uint32_t first; ///< range of the subtree's objects in tree order
+        uint32_t count;
+        uint32_t left;  ///< the right child follows the left one, 0 for leaves
+        uint32_t parent;
+    };
+
+    void updateNodeBounds(Node& node) const;
+    static float nodeCost(const Node& node);
+
+private:
+    std::vector<Node> m_nodes;               ///< parents before their children, the root first
+    std::vector<uint32_t> m_ids;             ///< object id per position in tree order
+    std::vector<uint32_t> m_positions;       ///< tree order position per object id
+    std::vector<uint32_t> m_leaves;          ///< leaf node per position
+    std::vector<BoundingBox> m_boxes;        ///< per position
+    FrustumCuller m_culler;                  ///< per position, tests the objects of partly visible leaves
+    std::vector<char> m_dirty;               ///< per node, bounds have to be refitted
+    bool m_refit_pending{false};
+
+    double m_cost{0.0};       ///< surface area heuristic, sum over the nodes, kept up to date by refit()
+    float m_built_cost{0.0f}; ///< right after build(), relative to the root area
+};
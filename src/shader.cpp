@@ -1,14 +1,13 @@
 #include "shader.h"
 
+#include <QDebug>
+#include <QFile>
 
-Shader::Shader()
-{
-    initializeOpenGLFunctions();
-}
 
 bool Shader::addShaderFromSourceFile(QOpenGLShader::ShaderType type, const QString& fileName)
 {
-    if (!QOpenGLShaderProgram::addShaderFromSourceFile(type, fileName))
+    // compilation is deferred to link() which first tries a program binary from the disk cache
+    if (!QOpenGLShaderProgram::addCacheableShaderFromSourceFile(type, fileName))
     {
         qDebug() << this->log();
         return false;
@@ -17,17 +16,32 @@ bool Shader::addShaderFromSourceFile(QOpenGLShader::ShaderType type, const QStri
     return true;
 }
 
-void Shader::create_uniform_block(void* data, size_t size)
+bool Shader::addShaderFromSourceFile(QOpenGLShader::ShaderType type, const QString& fileName,
+                                     const QStringList& defines)
 {
-    glGenBuffers(1, &m_uniform_vbo);
-    glBindBuffer(GL_UNIFORM_BUFFER, m_uniform_vbo);
-    glBufferData(GL_UNIFORM_BUFFER, size, data, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
-}
+    if (defines.isEmpty())
+        return addShaderFromSourceFile(type, fileName);
 
-void Shader::set_uniform_block_data(void* data, size_t size)
-{
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_uniform_vbo);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Cannot open shader" << fileName;
+        return false;
+    }
+    QByteArray source = file.readAll();
+
+    // defines have to follow the #version line
+    QByteArray define_lines;
+    for (const QString& define: defines)
+        define_lines += "#define " + define.toUtf8() + "\n";
+    const int version_end = source.startsWith("#version") ? source.indexOf('\n') + 1 : 0;
+    source.insert(version_end, define_lines);
+
+    if (!QOpenGLShaderProgram::addCacheableShaderFromSourceCode(type, source))
+    {
+        qDebug() << fileName << this->log();
+        return false;
+    }
+
+    return true;
 }
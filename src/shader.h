@@ -1,19 +1,17 @@
 #pragma once
 
-#include <QOpenGLFunctions_4_5_Core>
 #include <QOpenGLShaderProgram>
+#include <QStringList>
 
 
-class Shader : public QOpenGLShaderProgram, protected QOpenGLFunctions_4_5_Core
+/// Shader program whose stages go through Qt's program binary disk cache.
+///
+/// link() restores the binary stored by glGetProgramBinary on an earlier run if the sources and
+/// the GL vendor, renderer and version match, and silently compiles from source if there is none
+/// or the driver rejects it. Compile errors therefore only show up in the link log.
+class Shader : public QOpenGLShaderProgram
 {
 public:
-    Shader();
-
     bool addShaderFromSourceFile(QOpenGLShader::ShaderType type, const QString& fileName);
-    void create_uniform_block(void* data, size_t size);
-    void set_uniform_block_data(void* data, size_t size);
-    void unbind() { release(); }
-
-private:
-    GLuint m_uniform_vbo;
+    bool addShaderFromSourceFile(QOpenGLShader::ShaderType type, const QString& fileName, const QStringList& defines);
 };
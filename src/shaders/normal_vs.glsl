@@ -2,17 +2,18 @@
 
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal_in;
+layout(location = 3) in mat4 model; // per instance, includes the dequantization of position
 
 layout(location = 0) out vec3 normal;
 
 layout(std140, binding = 0) uniform UniformsForVS
 {
-    mat4 mvp;
+    mat4 view_projection;
 };
 
 
 void main()
 {
     normal = normal_in;
-    gl_Position = mvp * vec4(position, 1.0);
+    gl_Position = view_projection * model * vec4(position, 1.0);
 }
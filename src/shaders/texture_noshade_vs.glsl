@@ -2,17 +2,19 @@
 
 layout(location = 0) in vec3 position;
 layout(location = 2) in vec2 texcoord_in;
+layout(location = 3) in mat4 model; // per instance, includes the dequantization of position
 
 layout(location = 0) out vec2 texture_coord;
 
 layout(std140, binding = 0) uniform UniformsForVS
 {
-    mat4 matrix;
+    mat4 view_projection;
+    vec4 texcoord_transform; // offset xy and scale zw of quantized texcoords
 };
 
 
 void main()
 {
-    texture_coord = texcoord_in;
-    gl_Position = matrix * vec4(position, 1.0);
+    texture_coord = texcoord_transform.xy + texcoord_transform.zw * texcoord_in;
+    gl_Position = view_projection * model * vec4(position, 1.0);
 }
@@ -1,37 +1,47 @@
 #include "shape.h"
 
-#include "texture.h"
-
+#include <algorithm>
 #include <cassert>
 
 
+namespace
+{
+    const float LOD_PIXEL_ERROR = 1.0f; ///< largest acceptable projected simplification error
+    const float LOD_HYSTERESIS = 0.75f; ///< switching to a coarser level needs this much headroom, against popping
+    const float LOD_MIN_DISTANCE = 1e-3f;
+}
+
+
 RenderObject::RenderObject()
     : m_mesh{nullptr}
     , m_texture{nullptr}
 {
-    initializeOpenGLFunctions();
 }
 
-void RenderObject::setMesh(std::unique_ptr<Mesh> mesh)
+void RenderObject::setMesh(std::shared_ptr<Mesh> mesh)
 {
     m_mesh = std::move(mesh);
+    updateBounds();
 }
 
 void RenderObject::initGL()
 {
     m_mesh->initVBOs();
 
-    m_shader.create_uniform_block((void*)&m_model_matrix, sizeof(m_model_matrix));
+    // maps the mesh's quantized positions back into model space
+    const std::array<float, 3>& offset = m_mesh->getPositionOffset();
+    const std::array<float, 3>& scale = m_mesh->getPositionScale();
+    m_dequantization.setToIdentity();
+    m_dequantization.translate(offset[0], offset[1], offset[2]);
+    m_dequantization.scale(scale[0], scale[1], scale[2]);
 
-    if (!m_shader.link())
-    {
-        qDebug() << m_shader.log();
-    }
+    updateBounds();
 }
 
 void RenderObject::rotate(float angle)
 {
     m_model_matrix.rotate(angle, {1.0f, 0.0f, 0.0f});
+    updateBounds();
 }
 
 void RenderObject::translate(const Vec3D& pos)
@@ -42,67 +52,49 @@ void RenderObject::translate(const Vec3D& pos)
 void RenderObject::translate(float x, float y, float z)
 {
     m_model_matrix.translate(x, y, z);
+    updateBounds();
 }
 
-void RenderObject::setFragmentShader(const QString&& filename)
+void RenderObject::setPipeline(std::shared_ptr<const Pipeline> pipeline)
 {
-    m_shader.addShaderFromSourceFile(QOpenGLShader::Fragment, filename);
+    m_pipeline = std::move(pipeline);
 }
 
-void RenderObject::setVertexShader(const QString&& filename)
-{
-    m_shader.addShaderFromSourceFile(QOpenGLShader::Vertex, filename);
-}
-
-void RenderObject::setTexture(std::unique_ptr<Texture> texture)
+void RenderObject::setTexture(std::shared_ptr<Texture> texture)
 {
     m_texture = std::move(texture);
 }
 
-void RenderObject::setCullFaceMode(bool mode)
-{
-    m_cull_faces = mode;
-}
-
-void RenderObject::setWireframeMode(bool mode)
+size_t RenderObject::selectLod(const QVector3D& eye, float lod_scale)
 {
-    m_show_wireframe = mode;
+    const size_t lod_count = m_mesh->getLodCount();
+    if (1 == lod_count)
+        return 0;
+
+    // errors are in model space, the closest point of the bounding sphere decides how large they appear
+    const float scale = std::max({m_model_matrix.column(0).toVector3D().length(),
+                                  m_model_matrix.column(1).toVector3D().length(),
+                                  m_model_matrix.column(2).toVector3D().length()});
+    const float distance = std::max((m_bounding_sphere.center - eye).length() - m_bounding_sphere.radius,
+                                    LOD_MIN_DISTANCE);
+    const float pixels_per_unit = scale * lod_scale / distance;
+
+    size_t lod = std::min(m_lod, lod_count - 1);
+    while (0 < lod && m_mesh->getLodError(lod) * pixels_per_unit > LOD_PIXEL_ERROR)
+        --lod;
+    while (lod + 1 < lod_count && m_mesh->getLodError(lod + 1) * pixels_per_unit < LOD_HYSTERESIS * LOD_PIXEL_ERROR)
+        ++lod;
+
+    m_lod = lod;
+    return lod;
 }
 
-void RenderObject::render(const QMatrix4x4& pv)
+void RenderObject::updateBounds()
 {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    if (m_cull_faces)
-        glEnable(GL_CULL_FACE);
-    glPolygonMode(GL_FRONT_AND_BACK, m_show_wireframe ? GL_LINE : GL_FILL);
-
-    m_shader.bind();
-    const int position_location = m_shader.attributeLocation("position");
-    const int normal_location = m_shader.attributeLocation("normal_in");
-    const int texcoord_location = m_shader.attributeLocation("texcoord_in");
-    m_mesh->bindBuffers(position_location, normal_location, texcoord_location);
-
-    const QMatrix4x4 mvp = pv * m_model_matrix;
-    m_shader.set_uniform_block_data((void*)&mvp, sizeof(mvp));
-
-    if (m_texture)
-    {
-        m_texture->bind();
-        m_mesh->draw();
-        m_texture->unbind();
-    }
-    else
-    {
-        m_mesh->draw();
-    }
-
-    m_mesh->unbindBuffers();
-    m_shader.unbind();
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_BLEND);
+    if (!m_mesh)
+        return;
+    m_bounding_box = m_mesh->getBoundingBox().transformed(m_model_matrix);
+    m_bounding_sphere = m_mesh->getBoundingSphere().transformed(m_model_matrix);
 }
 
 void RenderObject::setAnimRotation(float angle)
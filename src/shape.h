@@ -3,23 +3,24 @@
 #include <memory>
 
 #include <QMatrix4x4>
-#include <QOpenGLFunctions_4_5_Core>
 
+#include "bounds.h"
 #include "mesh.h"
-#include "shader.h"
+#include "pipeline.h"
 #include "util.h"
 
 
 class Texture;
 
-class RenderObject : public QOpenGLFunctions_4_5_Core
+class RenderObject
 {
 public:
     RenderObject();
 
     void initGL();
     void animate();
-    void render(const QMatrix4x4& pv);
+    /// Level of detail to draw, lod_scale is the viewport height in pixels divided by 2 * tan(fovy / 2).
+    size_t selectLod(const QVector3D& eye, float lod_scale);
 
     void rotate(float angle);
     void translate(const Vec3D& pos);
@@ -27,21 +28,36 @@ public:
 
     void setAnimRotation(float angle);
 
-    void setFragmentShader(const QString&& filename);
-    void setVertexShader(const QString&& filename);
+    void setPipeline(std::shared_ptr<const Pipeline> pipeline);
+    /// World space bounds, follow the model matrix and the mesh.
+    const BoundingBox& getBoundingBox() const { return m_bounding_box; }
+    const BoundingSphere& getBoundingSphere() const { return m_bounding_sphere; }
+    Mesh* getMesh() const { return m_mesh.get(); }
+    const Pipeline* getPipeline() const { return m_pipeline.get(); }
+    Texture* getTexture() const { return m_texture.get(); }
+    /// Drawn after all opaque objects, sorted back to front.
+    bool isTransparent() const { return m_pipeline->getRasterState().blend; }
+    const QMatrix4x4& getModelMatrix() const { return m_model_matrix; } ///< applied to the mesh's positions
+    /// Model matrix applied to the mesh's quantized positions.
+    QMatrix4x4 getInstanceMatrix() const { return m_model_matrix * m_dequantization; }
+
+    void setMesh(std::shared_ptr<Mesh> mesh);
+    void setTexture(std::shared_ptr<Texture> texture);
 
-    void setCullFaceMode(bool mode);
-    void setMesh(std::unique_ptr<Mesh> mesh);
-    void setTexture(std::unique_ptr<Texture> texture);
-    void setWireframeMode(bool mode);
+private:
+    void updateBounds();
 
 private:
-    std::unique_ptr<Mesh> m_mesh;
-    Shader m_shader;
+    std::shared_ptr<Mesh> m_mesh; ///< may be shared through the MeshRegistry
+    std::shared_ptr<const Pipeline> m_pipeline; ///< shared through the PipelineCache
     QMatrix4x4 m_model_matrix;
-    std::unique_ptr<Texture> m_texture;
+    QMatrix4x4 m_dequantization; ///< from the mesh's quantized positions to model space
+    std::shared_ptr<Texture> m_texture; ///< shared through the TextureCache
+
+    BoundingBox m_bounding_box;       ///< of the mesh, in world space
+    BoundingSphere m_bounding_sphere; ///< of the mesh, in world space
+
+    size_t m_lod{0}; ///< level of detail drawn last frame
 
-    bool m_show_wireframe{false};
-    bool m_cull_faces{false};
     float m_anim_rotation{0.0f};
 };
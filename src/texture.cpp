@@ -1,46 +1,231 @@
 #include "texture.h"
 
+#include "gl_state.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QOpenGLContext>
+#include <QString>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+
+namespace
+{
+    const GLsizei MIPMAP_LEVELS = 4;
+    const char* const COMPRESSED_SUFFIXES[] = {"ktx2", "dds"};
+}
+
 
 Texture::Texture()
     : m_id{0}
-    , m_image{nullptr}
 {
-    initializeOpenGLFunctions();
 }
 
-void Texture::bind()
+Texture::~Texture()
 {
-    glBindTextureUnit(0, m_id);
+    // shared textures die with their last render object, that is on the render thread
+    if (isCreated() && QOpenGLContext::currentContext())
+        glDeleteTextures(1, &m_id);
 }
 
-void Texture::unbind()
+void Texture::bind(GlState& state, GLuint unit)
 {
-    glBindTextureUnit(0, 0);
+    state.bindTextureUnit(unit, m_id);
 }
 
 bool Texture::loadFromFile(const std::string& filename)
 {
-    m_image = std::make_unique<QImage>(filename.c_str());
-    if (!m_image->isNull())
+    return setSource(filename) && upload();
+}
+
+bool Texture::setSource(const std::string& filename)
+{
+    // a precompressed sibling like diffuse.ktx2 next to diffuse.png wins over the original
+    const QFileInfo info(QString::fromStdString(filename));
+    for (const char* suffix: COMPRESSED_SUFFIXES)
+    {
+        const QString compressed = info.absolutePath() + '/' + info.completeBaseName() + '.' + suffix;
+        if (QFileInfo(compressed).exists() && setCompressedSource(compressed.toStdString()))
+            return true;
+    }
+    return setImageSource(filename);
+}
+
+bool Texture::setCompressedSource(const std::string& filename)
+{
+    QFile file(QString::fromStdString(filename));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+
+    CompressedImage image;
+    if (!image.parse(data, static_cast<size_t>(file.size())))
     {
-        uploadToGPU(4);
-        m_image.release(); // we don't need it in main memory anymore
-        return 0 < m_id;
+        qDebug() << "Unsupported compressed texture" << filename.c_str();
+        return false;
     }
-    return false;
+
+    m_filename = filename;
+    m_format = image.format();
+    m_width = image.width();
+    m_height = image.height();
+    m_compressed_levels = image.levels();
+
+    size_t offset = 0;
+    for (CompressedImage::Level& level: m_compressed_levels)
+    {
+        level.offset = offset;
+        offset += level.size;
+    }
+    return true;
 }
 
-void Texture::uploadToGPU(int nof_mipmaps)
+bool Texture::setImageSource(const std::string& filename)
 {
+    const QSize size = QImageReader(QString::fromStdString(filename)).size();
+    if (!size.isValid())
+        return false;
+
+    m_filename = filename;
+    m_format = GL_RGBA8;
+    m_width = size.width();
+    m_height = size.height();
+    m_compressed_levels.clear();
+    return true;
+}
+
+size_t Texture::dataSize() const
+{
+    if (isCompressed())
+        return m_compressed_levels.back().offset + m_compressed_levels.back().size;
+    return 4 * static_cast<size_t>(m_width) * static_cast<size_t>(m_height);
+}
+
+bool Texture::decodeInto(uchar* pixels) const
+{
+    return isCompressed() ? decodeCompressed(pixels) : decodeImage(pixels);
+}
+
+bool Texture::decodeCompressed(uchar* pixels) const
+{
+    QFile file(QString::fromStdString(m_filename));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+
+    // the file may have changed since setSource()
+    CompressedImage image;
+    if (!image.parse(data, static_cast<size_t>(file.size())) || image.format() != m_format
+        || image.width() != m_width || image.height() != m_height
+        || image.levels().size() != m_compressed_levels.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < m_compressed_levels.size(); ++i)
+    {
+        std::memcpy(pixels + m_compressed_levels[i].offset, data + image.levels()[i].offset,
+                    m_compressed_levels[i].size);
+    }
+    return true;
+}
+
+bool Texture::decodeImage(uchar* rgba) const
+{
+    // QImage is reentrant, so decoding is safe on loader threads
+    QImage image(QString::fromStdString(m_filename));
+    if (image.isNull() || image.width() != m_width || image.height() != m_height)
+        return false;
+    if (QImage::Format_ARGB32 != image.format() && QImage::Format_RGB32 != image.format())
+        image = image.convertToFormat(QImage::Format_ARGB32);
+
+    // swizzle straight into the destination instead of going through rgbSwapped()
+    for (int y = 0; y < m_height; ++y)
+    {
+        const QRgb* src = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0; x < m_width; ++x)
+        {
+            *rgba++ = static_cast<uchar>(qRed(src[x]));
+            *rgba++ = static_cast<uchar>(qGreen(src[x]));
+            *rgba++ = static_cast<uchar>(qBlue(src[x]));
+            *rgba++ = static_cast<uchar>(qAlpha(src[x]));
+        }
+    }
+    return true;
+}
+
+void Texture::create()
+{
+    initializeOpenGLFunctions();
+    m_levels = isCompressed() ? static_cast<GLsizei>(m_compressed_levels.size()) : MIPMAP_LEVELS;
     glCreateTextures(GL_TEXTURE_2D, 1, &m_id);
-    glTextureStorage2D(m_id, nof_mipmaps, GL_RGBA8, m_image->width(), m_image->height());
-    glTextureSubImage2D(m_id, 0, 0, 0, m_image->width(), m_image->height(),
-                        GL_RGBA, GL_UNSIGNED_BYTE, m_image->rgbSwapped().bits());
+    glTextureStorage2D(m_id, m_levels, m_format, m_width, m_height);
+}
+
+bool Texture::upload()
+{
+    if (isUploaded())
+        return true;
+
+    std::vector<uchar> pixels(dataSize());
+    if (!decodeInto(pixels.data()))
+        return false;
 
-    if (0 < nof_mipmaps)
+    if (!isCreated())
+        create();
+    uploadPixels(pixels.data());
+
+    m_uploaded = true;
+    return true;
+}
+
+void Texture::uploadFromBuffer(GLuint pixel_buffer, size_t offset)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+    uploadPixels(reinterpret_cast<const uchar*>(offset));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void Texture::uploadPixels(const uchar* pixels)
+{
+    if (!isCompressed())
     {
+        glTextureSubImage2D(m_id, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
         glGenerateTextureMipmap(m_id);
+        return;
+    }
+
+    for (size_t i = 0; i < m_compressed_levels.size(); ++i)
+    {
+        const CompressedImage::Level& level = m_compressed_levels[i];
+        glCompressedTextureSubImage2D(m_id, static_cast<GLint>(i), 0, 0, level.width, level.height, m_format,
+                                      static_cast<GLsizei>(level.size), pixels + level.offset);
+    }
+}
+
+size_t Texture::gpuMemory() const
+{
+    if (isCompressed())
+        return isCreated() ? dataSize() : 0;
+
+    size_t bytes = 0;
+    for (GLsizei level = 0; level < m_levels; ++level)
+    {
+        const auto width = static_cast<size_t>(std::max(1, m_width >> level));
+        const auto height = static_cast<size_t>(std::max(1, m_height >> level));
+        bytes += 4 * width * height; // GL_RGBA8
     }
+    return bytes;
 }
 
 void Texture::setAnisotropicFilteringLevel(int level)
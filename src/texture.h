@@ -1,30 +1,66 @@
 #pragma once
 
-#include <memory>
+#include <cstddef>
 #include <string>
+#include <vector>
 
-#include <QImage>
 #include <QOpenGLFunctions_4_5_Core>
 
+#include "compressed_image.h"
 
+class GlState;
+
+
+/// 2D texture with mipmaps.
+///
+/// Block compressed DDS/KTX2 files are uploaded as is with their prebuilt mip chain, everything
+/// else is decoded with QImage into RGBA8 and mipmapped at runtime.
+///
+/// setSource() and decodeInto() don't touch GL and may run on any thread, everything else belongs
+/// to the render thread. The pixels are either uploaded synchronously with upload() or streamed
+/// in by the TextureStreamer.
 class Texture : protected QOpenGLFunctions_4_5_Core
 {
 public:
     explicit Texture();
+    ~Texture();
 
     bool loadFromFile(const std::string& filename);
 
-    void bind();
-    void unbind();
+    bool setSource(const std::string& filename); ///< only reads the image header
+    bool decodeInto(uchar* pixels) const;        ///< pixels must hold dataSize() bytes
+    size_t dataSize() const;
+    bool isCompressed() const { return !m_compressed_levels.empty(); }
+
+    void create(); ///< allocates the GL storage, contents stay undefined until uploaded
+    bool upload(); ///< decodes and uploads on the calling thread, no-op if already uploaded
+    void uploadFromBuffer(GLuint pixel_buffer, size_t offset);
+    void setUploaded() { m_uploaded = true; }
+
+    bool isCreated() const { return 0 < m_id; }
+    bool isUploaded() const { return m_uploaded; }
+    size_t gpuMemory() const; ///< estimated size of the texture storage including mipmaps
+
+    void bind(GlState& state, GLuint unit = 0);
 
     void setAnisotropicFilteringLevel(int level);
     void setMinMagFilters(GLint min_filter, GLint mag_filter);
     void setWrappingST(GLint s_wrapping, GLint t_wrapping);
 
 private:
-    void uploadToGPU(int nof_mipmaps);
+    bool setCompressedSource(const std::string& filename);
+    bool setImageSource(const std::string& filename);
+    bool decodeCompressed(uchar* pixels) const;
+    bool decodeImage(uchar* rgba) const;
+    void uploadPixels(const uchar* pixels); ///< client memory or an offset into the bound unpack buffer
 
 private:
+    std::string m_filename;
     GLuint m_id;
-    std::unique_ptr<QImage> m_image;
+    GLenum m_format{GL_RGBA8};
+    std::vector<CompressedImage::Level> m_compressed_levels; ///< offsets are packed, not file offsets
+    GLsizei m_width{0};
+    GLsizei m_height{0};
+    GLsizei m_levels{0};
+    bool m_uploaded{false};
 };
@@ -0,0 +1,61 @@
+#include "texture_cache.h"
+
+#include "texture.h"
+
+#include <QFileInfo>
+
+
+std::shared_ptr<Texture> TextureCache::acquire(const std::string& filename)
+{
+    const QString key = QFileInfo(QString::fromStdString(filename)).canonicalFilePath();
+    if (key.isEmpty())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_textures.find(key);
+    if (it != m_textures.end())
+    {
+        std::shared_ptr<Texture> texture = it->second.lock();
+        if (texture)
+        {
+            ++m_hits;
+            return texture;
+        }
+        m_textures.erase(it);
+    }
+
+    ++m_misses;
+    auto texture = std::make_shared<Texture>();
+    if (!texture->setSource(key.toStdString()))
+        return nullptr;
+
+    m_textures.emplace(key, texture);
+    return texture;
+}
+
+size_t TextureCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+size_t TextureCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+size_t TextureCache::residentBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t bytes = 0;
+    for (const auto& entry: m_textures)
+    {
+        const std::shared_ptr<Texture> texture = entry.second.lock();
+        if (texture)
+            bytes += texture->gpuMemory();
+    }
+    return bytes;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QString>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+class Texture;
+
+
+/// Shares textures between render objects.
+///
+/// Entries are keyed by the canonical file path and only hold weak references, a texture is
+/// released as soon as the last render object using it goes away. acquire() may be called from
+/// loader threads, it only reads the image header, decoding and upload happen later.
+class TextureCache
+{
+public:
+    /// Returns the cached texture for filename or a new one, null if the image can't be read.
+    std::shared_ptr<Texture> acquire(const std::string& filename);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t residentBytes() const; ///< GPU memory of all live uploaded textures, call from the render thread
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<QString, std::weak_ptr<Texture>> m_textures;
+    size_t m_hits{0};
+    size_t m_misses{0};
+};
@@ -0,0 +1,180 @@
+#include "texture_streamer.h"
+
+#include "texture.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+
+namespace
+{
+    const size_t STAGING_BUFFER_SIZE = size_t{64} << 20;
+    const size_t MAX_DECODE_THREADS = 4;
+}
+
+
+TextureStreamer::TextureStreamer() = default;
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_job_available.notify_all();
+    for (std::thread& worker: m_workers)
+        worker.join();
+
+    for (const PendingUpload& upload: m_uploads)
+        glDeleteSync(upload.fence);
+    if (m_buffer)
+    {
+        glUnmapNamedBuffer(m_buffer);
+        glDeleteBuffers(1, &m_buffer);
+    }
+}
+
+void TextureStreamer::initialize()
+{
+    initializeOpenGLFunctions();
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &m_buffer);
+    glNamedBufferStorage(m_buffer, STAGING_BUFFER_SIZE, nullptr, flags);
+    m_mapped = static_cast<uchar*>(glMapNamedBufferRange(m_buffer, 0, STAGING_BUFFER_SIZE, flags));
+
+    // leave one core for the render thread and the model loader
+    const size_t cores = std::max(2u, std::thread::hardware_concurrency());
+    const size_t thread_count = std::min(MAX_DECODE_THREADS, cores - 1);
+    for (size_t i = 0; i < thread_count; ++i)
+        m_workers.emplace_back(&TextureStreamer::run, this);
+}
+
+void TextureStreamer::request(std::shared_ptr<Texture> texture)
+{
+    m_waiting.push_back(std::move(texture));
+}
+
+void TextureStreamer::update()
+{
+    // retire uploads the GPU is done with, their staging ranges become free again
+    while (!m_uploads.empty())
+    {
+        const PendingUpload& upload = m_uploads.front();
+        const GLenum status = glClientWaitSync(upload.fence, 0, 0);
+        if (GL_ALREADY_SIGNALED != status && GL_CONDITION_SATISFIED != status)
+            break;
+
+        glDeleteSync(upload.fence);
+        upload.texture->setUploaded();
+        release(upload.offset);
+        m_uploads.pop_front();
+    }
+
+    std::deque<DecodeJob> decoded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        decoded.swap(m_decoded);
+    }
+    for (DecodeJob& job: decoded)
+    {
+        if (!job.ok)
+        {
+            qDebug() << "Could not decode texture";
+            release(job.offset);
+            continue;
+        }
+        job.texture->uploadFromBuffer(m_buffer, job.offset);
+        m_uploads.push_back({std::move(job.texture), job.offset, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+    }
+
+    bool queued = false;
+    while (!m_waiting.empty())
+    {
+        std::shared_ptr<Texture>& texture = m_waiting.front();
+        if (texture->dataSize() > STAGING_BUFFER_SIZE)
+        {
+            // too large to ever fit, take the stall instead
+            texture->upload();
+            m_waiting.pop_front();
+            continue;
+        }
+
+        size_t offset;
+        if (!allocate(texture->dataSize(), &offset))
+            break; // wait for running uploads to free up space
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({std::move(texture), offset, false});
+        }
+        m_waiting.pop_front();
+        queued = true;
+    }
+    if (queued)
+        m_job_available.notify_all();
+}
+
+bool TextureStreamer::allocate(size_t size, size_t* offset)
+{
+    size = (size + 3) & ~size_t{3};
+
+    if (m_allocations.empty())
+    {
+        *offset = 0;
+    }
+    else
+    {
+        // ring buffer: free space is behind the newest and in front of the oldest allocation
+        const Allocation& oldest = m_allocations.front();
+        const Allocation& newest = m_allocations.back();
+        const size_t end = newest.offset + newest.size;
+
+        if (newest.offset >= oldest.offset && end + size <= STAGING_BUFFER_SIZE)
+            *offset = end;
+        else if (newest.offset >= oldest.offset && size <= oldest.offset)
+            *offset = 0;
+        else if (newest.offset < oldest.offset && end + size <= oldest.offset)
+            *offset = end;
+        else
+            return false;
+    }
+
+    m_allocations.push_back({*offset, size, false});
+    return true;
+}
+
+void TextureStreamer::release(size_t offset)
+{
+    for (Allocation& allocation: m_allocations)
+    {
+        if (allocation.offset == offset && !allocation.released)
+        {
+            allocation.released = true;
+            break;
+        }
+    }
+    while (!m_allocations.empty() && m_allocations.front().released)
+        m_allocations.pop_front();
+}
+
+void TextureStreamer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_job_available.wait(lock, [this] { return m_shutdown || !m_jobs.empty(); });
+        if (m_shutdown)
+            return;
+
+        DecodeJob job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+
+        lock.unlock();
+        job.ok = job.texture->decodeInto(m_mapped + job.offset);
+        lock.lock();
+
+        m_decoded.push_back(std::move(job));
+    }
+}
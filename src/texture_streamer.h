@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QOpenGLFunctions_4_5_Core>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class Texture;
+
+
+/// Asynchronous texture uploads through a persistently mapped pixel buffer.
+///
+/// The render thread reserves a range of the staging buffer for every requested texture. A small
+/// thread pool decodes the images and writes the swizzled RGBA pixels straight into that range,
+/// then the render thread issues the copy into the texture and a fence. The range is reused once
+/// the fence has signaled, so neither side ever waits for the other.
+class TextureStreamer : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    TextureStreamer();
+    ~TextureStreamer(); ///< needs the GL context to be current
+
+    void initialize();
+
+    void request(std::shared_ptr<Texture> texture); ///< texture must already be created
+    void update();                                  ///< call once per frame
+
+private:
+    struct Allocation
+    {
+        size_t offset;
+        size_t size;
+        bool released;
+    };
+
+    struct DecodeJob
+    {
+        std::shared_ptr<Texture> texture;
+        size_t offset;
+        bool ok;
+    };
+
+    struct PendingUpload
+    {
+        std::shared_ptr<Texture> texture;
+        size_t offset;
+        GLsync fence;
+    };
+
+    bool allocate(size_t size, size_t* offset);
+    void release(size_t offset);
+    void run();
+
+private:
+    GLuint m_buffer{0};
+    uchar* m_mapped{nullptr};
+
+    std::deque<std::shared_ptr<Texture>> m_waiting; ///< no staging space yet
+    std::deque<Allocation> m_allocations;           ///< in allocation order
+    std::deque<PendingUpload> m_uploads;
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    std::deque<DecodeJob> m_jobs;
+    std::deque<DecodeJob> m_decoded;
+    bool m_shutdown{false};
+};